@@ -0,0 +1,107 @@
+#include "cloudloader.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMetaObject>
+
+CloudLoader::CloudLoader(const QString& file, const Decode& d, QObject* parent)
+    : QObject(parent)
+    , path(file)
+    , decode(d)
+    , busy(false)
+    , again(false)
+    , forced(false)
+{
+    const QFileInfo info(path);
+    last_modified = info.lastModified();
+    last_size = info.size();
+
+    // downloads usually replace the file, which drops it from the
+    // watcher, the directory tells when it comes back
+    watcher.addPath(path);
+    watcher.addPath(info.absolutePath());
+    connect(&watcher, &QFileSystemWatcher::fileChanged, this, &CloudLoader::changed);
+    connect(&watcher, &QFileSystemWatcher::directoryChanged, this, &CloudLoader::changed);
+
+    settle.setSingleShot(true);
+    settle.setInterval(1000);
+    connect(&settle, &QTimer::timeout, this, &CloudLoader::startDecode);
+}
+
+CloudLoader::~CloudLoader()
+{
+    if (thread.joinable())
+        thread.join();
+}
+
+std::shared_ptr<QImage> CloudLoader::take()
+{
+    if (!std::atomic_load(&ready))
+        return nullptr;
+    return std::atomic_exchange(&ready, std::shared_ptr<QImage>());
+}
+
+void CloudLoader::reload()
+{
+    QMetaObject::invokeMethod(this, "forceDecode", Qt::QueuedConnection);
+}
+
+void CloudLoader::forceDecode()
+{
+    forced = true;
+    startDecode();
+}
+
+/*
+ * Also called for every other file in the directory, only go on if
+ * this one looks different.
+ */
+void CloudLoader::changed()
+{
+    if (!watcher.files().contains(path) && QFile::exists(path))
+        watcher.addPath(path);
+    if (modified())
+        settle.start();
+}
+
+bool CloudLoader::modified()
+{
+    const QFileInfo info(path);
+    return info.exists() && (info.lastModified() != last_modified || info.size() != last_size);
+}
+
+void CloudLoader::startDecode()
+{
+    if (busy) {
+        again = true;
+        return;
+    }
+    if (thread.joinable())
+        thread.join();
+
+    forced = false;
+    const QFileInfo info(path);
+    last_modified = info.lastModified();
+    last_size = info.size();
+    busy = true;
+    qDebug() << "Loading cloud map" << path;
+
+    thread = std::thread([this] {
+        if (auto image = decode(path))
+            std::atomic_store(&ready, image);
+        else
+            qWarning() << "Can't read cloud map" << path << ", keeping the old one";
+        QMetaObject::invokeMethod(this, "decodeFinished", Qt::QueuedConnection);
+    });
+}
+
+void CloudLoader::decodeFinished()
+{
+    busy = false;
+    if (again) {
+        again = false;
+        if (forced || modified())
+            startDecode();
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QImage>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+/*
+ * Watches a cloud map file and decodes it again on a background thread
+ * whenever it changes. The renderer picks the new map up with take() at
+ * the start of a frame and keeps using the old one until then, so a
+ * frame never waits for the file.
+ *
+ * Needs an event loop, create it on the GUI thread. take() may be called
+ * from any one thread.
+ */
+class CloudLoader : public QObject {
+    Q_OBJECT
+
+public:
+    /* turns the file into the map to use, nullptr if it can't be read */
+    typedef std::function<std::shared_ptr<QImage>(const QString&)> Decode;
+
+    CloudLoader(const QString& path, const Decode& decode, QObject* parent = nullptr);
+    ~CloudLoader();
+
+    /* the map decoded since the last call, nullptr if there is none */
+    std::shared_ptr<QImage> take();
+
+    /* decode the file again although it didn't change, for a map of
+     * another size; may be called from any thread */
+    void reload();
+
+private slots:
+    void changed();
+    void forceDecode();
+    void startDecode();
+    void decodeFinished();
+
+private:
+    bool modified();
+
+    const QString path;
+    const Decode decode;
+    QFileSystemWatcher watcher;
+    QTimer settle; // writers take a while, wait for them to finish
+    QDateTime last_modified;
+    qint64 last_size;
+
+    std::thread thread;
+    bool busy; // thread is decoding
+    bool again; // the file changed while it was
+    bool forced; // decode again even if it didn't, see reload()
+    std::shared_ptr<QImage> ready; // only through the atomic functions
+};
@@ -80,6 +80,19 @@ CommandLineParser::CommandLineParser(QCoreApplication* parent)
       shade_areaOption(QStringList() << "shade_area", "Specify the proportion of the day-side to be progressively shaded prior to a transition with the night-side.  A value of 100 means all the day area will be shaded, whereas 0 will result in no shading at all.  60 would keep 40\% of the day area nearest the sun free from shading.", "pct", "100"),
       markerFontOption(QStringList() << "markerfont", "", "font", "helvetica"),
       markerFontSizeOption(QStringList() << "markerfontsize", "", "fontsize", "12"),
+      threadsOption(QStringList() << "threads", "Number of threads used to render the globe. The image is the same for any number of threads. (default: one per CPU)", "n", ""),
+      kernelOption(QStringList() << "kernel", "Ray tracing kernel: auto, scalar, sse2, avx2 or avx512. auto picks the fastest one the CPU supports, scalar is the reference implementation. (default: auto)", "kernel", "auto"),
+      incrementalOption("incremental", "With a fixed viewing position, only repaint the pixels whose lighting changed since the last frame. Has no effect together with markers or a grid."),
+      mipmapOption(QStringList() << "mipmap", "How maps larger than the globe on screen are sampled: off always uses the full map, level a smaller copy with about one texel per pixel, blend also fades to the next smaller copy towards the edge of the globe. (default: level)", "mode", "level"),
+      texlayoutOption(QStringList() << "texlayout", "Memory layout of the maps: linear keeps the rows of the image, tiled stores 16x16 texel tiles, which can be friendlier to the CPU caches. (default: linear)", "layout", "linear"),
+      benchmarkOption(QStringList() << "benchmark", "Render the first frame n times with each texture layout, print the time per frame and the cache misses, then exit.", "n", ""),
+      nomapcacheOption("nomapcache", "Always decode the map files instead of using the decoded copies XGlobe keeps in ~/.xglobe/cache. Copies not used for 30 days are removed, the directory can be deleted at any time."),
+      texmemOption(QStringList() << "texmem", "Maps that would take more than this many MB of memory are split into tiles kept in the cache directory, only the tiles in view are loaded. Default is 256, 0 to always load the whole map.", "MB", ""),
+      nighttintOption("nighttint", "Keep the night map as the brightness of its lights and one tint color, which takes a quarter of the memory. Suits night maps whose city lights are all about the same color."),
+      encoderOption(QStringList() << "encoder", "Format of the image files written for the wallpaper and by -dump: png, png:level or png:level:filter, ppm, bmp or qoi. level is the zlib compression from 0 to 9, filter the PNG row filter: none, sub, up, average, paeth or adaptive. ppm and bmp aren't compressed, qoi compresses a little, all of them take far less time than png. xwallpaper only reads png of these, Plasma also ppm and bmp, -x11root doesn't write files. Default is png:6:adaptive.", "format", "png"),
+      x11rootOption("x11root", "Set the background of the X11 root window directly, through shared memory, instead of writing an image file for xwallpaper."),
+      renderaheadOption("renderahead", "Render and write the next wallpaper at idle priority as soon as the last one is up, so that only handing it to the desktop is left when it is due."),
+      adaptiveOption("adaptive", "Wait longer than -wait while the globe would change by less than a pixel, going by its size on screen and how fast the sun moves. Frames that are done too late are dropped instead of shown."),
       xwallpaperOption(QStringList() << "xwallpaper-opt",
                        QString::fromLatin1("xwallpaper options. If the argument string contains an ")
                                            + xwallpaprer_image_tag
@@ -87,7 +100,6 @@ CommandLineParser::CommandLineParser(QCoreApplication* parent)
                        "xwallpaper-args",
                        QString::fromLatin1("--zoom ") + xwallpaprer_image_tag)
 {
-   tmpImageFile.open();
    setApplicationDescription(QString::fromLatin1("\nXGlobe displays the earth from your favourite point in space, similar to Xearth.")
                              + QString::fromLatin1("\n\nWhen starting, XGlobe looks for maps and marker files in the following order:")
                              + QString::fromLatin1("\n")
@@ -154,11 +166,29 @@ CommandLineParser::CommandLineParser(QCoreApplication* parent)
    addOption(shade_areaOption);
    addOption(markerFontOption);
    addOption(markerFontSizeOption);
+   addOption(threadsOption);
+   addOption(kernelOption);
+   addOption(incrementalOption);
+   addOption(mipmapOption);
+   addOption(texlayoutOption);
+   addOption(benchmarkOption);
+   addOption(nomapcacheOption);
+   addOption(texmemOption);
+   addOption(nighttintOption);
+   addOption(encoderOption);
+   addOption(x11rootOption);
+   addOption(renderaheadOption);
+   addOption(adaptiveOption);
    addOption(xwallpaperOption);
 
     // Process the actual command line arguments given by the user
     process(*parent);
 
+    // the wallpaper setters may go by the suffix
+    tmpImageFile.setFileTemplate(QDir::tempPath() + "/xglobe-dump.XXXXXX."
+                                 + ImageEncoder::suffix(getEncoder().format));
+    tmpImageFile.open();
+
     const QStringList args = positionalArguments();
     // source is args.at(0), destination is args.at(1)
 
@@ -541,7 +571,7 @@ QString
 CommandLineParser::getNightMapfile() const
 {
     if (!isSet(nightmapfileOption))
-        return QString();
+        return default_map_night;
 
     const QString nightmapfile = value(nightmapfileOption);
     const bool exists = QFile::exists(nightmapfile);
@@ -573,7 +603,7 @@ CommandLineParser::getCloudMapFilter() const
 bool
 CommandLineParser::isNightmap() const
 {
-    return isSet(nightmapOption) || isSet(nonightmapOption);
+    return (isSet(nightmapOption) || isSet(nightmapfileOption)) && !isSet(nonightmapOption);
 }
 
 double
@@ -691,3 +721,126 @@ QString CommandLineParser::getDefaultMarkerFile() const
 {
     return default_marker_file;
 }
+
+int CommandLineParser::getThreads() const
+{
+    return getIntByValue(0, threadsOption);
+}
+
+KernelType CommandLineParser::getKernel() const
+{
+    const QString kernel = value(kernelOption);
+    if (kernel == QLatin1String("scalar"))
+        return KernelType::scalar;
+    if (kernel == QLatin1String("sse2"))
+        return KernelType::sse2;
+    if (kernel == QLatin1String("avx2"))
+        return KernelType::avx2;
+    if (kernel == QLatin1String("avx512"))
+        return KernelType::avx512;
+    if (kernel != QLatin1String("auto"))
+        qWarning() << "Unknown kernel: " << kernel;
+    return KernelType::automatic;
+}
+
+bool CommandLineParser::isIncremental() const
+{
+    return isSet(incrementalOption);
+}
+
+MipMode CommandLineParser::getMipmap() const
+{
+    const QString mode = value(mipmapOption);
+    if (mode == QLatin1String("off"))
+        return MipMode::off;
+    if (mode == QLatin1String("blend"))
+        return MipMode::blend;
+    if (mode != QLatin1String("level"))
+        qWarning() << "Unknown mipmap mode: " << mode;
+    return MipMode::level;
+}
+
+TexLayout CommandLineParser::getTextureLayout() const
+{
+    const QString layout = value(texlayoutOption);
+    if (layout == QLatin1String("tiled"))
+        return TexLayout::tiled;
+    if (layout != QLatin1String("linear"))
+        qWarning() << "Unknown texture layout: " << layout;
+    return TexLayout::linear;
+}
+
+int CommandLineParser::getBenchmarkFrames() const
+{
+    return getIntByValue(0, benchmarkOption);
+}
+
+bool CommandLineParser::isMapCache() const
+{
+    return !isSet(nomapcacheOption);
+}
+
+int CommandLineParser::getTextureMemory() const
+{
+    return getIntByValue(256, texmemOption);
+}
+
+bool CommandLineParser::isNightTint() const
+{
+    return isSet(nighttintOption);
+}
+
+EncoderSettings CommandLineParser::getEncoder() const
+{
+    EncoderSettings settings;
+    const QStringList spec = value(encoderOption).split(QLatin1Char(':'));
+    const QString format = spec.at(0);
+    if (format == QLatin1String("ppm"))
+        settings.format = ImageFormat::ppm;
+    else if (format == QLatin1String("bmp"))
+        settings.format = ImageFormat::bmp;
+    else if (format == QLatin1String("qoi"))
+        settings.format = ImageFormat::qoi;
+    else if (format != QLatin1String("png"))
+        qWarning() << "Unknown encoder: " << format;
+
+    if (spec.size() > 1) {
+        bool ok = false;
+        const int level = spec.at(1).toInt(&ok);
+        if (ok && level >= 0 && level <= 9)
+            settings.level = level;
+        else
+            qWarning() << "Compression level should be 0 to 9: " << spec.at(1);
+    }
+    if (spec.size() > 2) {
+        const QString filter = spec.at(2);
+        if (filter == QLatin1String("none"))
+            settings.filter = PngFilter::none;
+        else if (filter == QLatin1String("sub"))
+            settings.filter = PngFilter::sub;
+        else if (filter == QLatin1String("up"))
+            settings.filter = PngFilter::up;
+        else if (filter == QLatin1String("average"))
+            settings.filter = PngFilter::average;
+        else if (filter == QLatin1String("paeth"))
+            settings.filter = PngFilter::paeth;
+        else if (filter != QLatin1String("adaptive"))
+            qWarning() << "Unknown PNG filter: " << filter;
+    }
+    return settings;
+}
+
+bool CommandLineParser::isX11Root() const
+{
+    return isSet(x11rootOption);
+}
+
+bool CommandLineParser::isRenderAhead() const
+{
+    return isSet(renderaheadOption);
+}
+
+bool CommandLineParser::isAdaptive() const
+{
+    return isSet(adaptiveOption);
+}
@@ -3,6 +3,7 @@
 #include <QTemporaryFile>
 #include <QCommandLineParser>
 #include "geo_coordinate.h"
+#include "imageencoder.h"
 #include "renderer.h"
 
 class QCoreApplication;
@@ -55,6 +56,19 @@ public:
     QStringList getXWallpaperOptions(QString const&) const;
     QString getXwallpaperExe() const;
     QString getDefaultMarkerFile() const;
+    int getThreads() const;
+    KernelType getKernel() const;
+    bool isIncremental() const;
+    MipMode getMipmap() const;
+    TexLayout getTextureLayout() const;
+    int getBenchmarkFrames() const;
+    bool isMapCache() const;
+    int getTextureMemory() const; // MB
+    bool isNightTint() const;
+    EncoderSettings getEncoder() const;
+    bool isX11Root() const;
+    bool isRenderAhead() const;
+    bool isAdaptive() const;
 
 private:
     void computeCoordinate();
@@ -109,6 +123,19 @@ private:
     QCommandLineOption shade_areaOption;
     QCommandLineOption markerFontOption;
     QCommandLineOption markerFontSizeOption;
+    QCommandLineOption threadsOption;
+    QCommandLineOption kernelOption;
+    QCommandLineOption incrementalOption;
+    QCommandLineOption mipmapOption;
+    QCommandLineOption texlayoutOption;
+    QCommandLineOption benchmarkOption;
+    QCommandLineOption nomapcacheOption;
+    QCommandLineOption texmemOption;
+    QCommandLineOption nighttintOption;
+    QCommandLineOption encoderOption;
+    QCommandLineOption x11rootOption;
+    QCommandLineOption renderaheadOption;
+    QCommandLineOption adaptiveOption;
 
     const QString xwallpaprer_image_tag = QLatin1String("XIMAGE");
     QCommandLineOption xwallpaperOption;
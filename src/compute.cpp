@@ -27,3 +27,16 @@ void RotMatrix::transpose()
     swap(m13, m31);
     swap(m23, m32);
 }
+
+void RotMatrix::elements(double m[9]) const
+{
+    m[0] = m11;
+    m[1] = m12;
+    m[2] = m13;
+    m[3] = m21;
+    m[4] = m22;
+    m[5] = m23;
+    m[6] = m31;
+    m[7] = m32;
+    m[8] = m33;
+}
@@ -12,6 +12,7 @@ public:
         dest_z = m31 * src_x + m32 * src_y + m33 * src_z;
     }
     void transpose();
+    void elements(double m[9]) const;
 
 private:
     double m11, m12, m13, m21, m22, m23, m31, m32, m33;
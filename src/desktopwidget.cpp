@@ -31,13 +31,12 @@
 DesktopWidget::DesktopWidget(QWidget* parent)
     : QWidget(parent)
 {
-    currentImage = std::make_unique<QPixmap>(width(), height());
 }
 
 void DesktopWidget::paintEvent(QPaintEvent* pe)
 {
     QPainter p(this);
-    if (!haveImage) {
+    if (!currentImage) {
         p.setFont(QFont("helvetica", 35));
         QRect br = p.fontMetrics().boundingRect("Please wait...");
         p.setPen(QColor(255, 0, 0));
@@ -46,14 +45,18 @@ void DesktopWidget::paintEvent(QPaintEvent* pe)
             "Please wait...");
     }
     else {
-        p.drawPixmap(pe->rect().left(), pe->rect().top(),
-            *currentImage, pe->rect().left(), pe->rect().top(),
-            pe->rect().width(), pe->rect().height());
+        // RGB32 goes to the backing store as it is
+        for (const QRect& rect : pe->region())
+            p.drawImage(rect.topLeft(), *currentImage, rect);
     }
 }
 
-void DesktopWidget::updateDisplay(QImage const& image)
+void DesktopWidget::updateDisplay(std::shared_ptr<const QImage> const& frame, const QRegion& changed)
 {
-    currentImage->convertFromImage(image);
-    haveImage = true;
+    const bool first = !currentImage;
+    currentImage = frame;
+    if (first)
+        update();
+    else
+        update(changed);
 }
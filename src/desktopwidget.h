@@ -21,19 +21,25 @@
  */
 #pragma once
 
+#include <QImage>
 #include <QPainter>
-#include <QPixmap>
+#include <QRegion>
 #include <QWidget>
 
 #include <memory>
 
+/*
+ * Shows the frames in a window. The frame is drawn as it comes from the
+ * renderer, without converting it to a pixmap first, and only where it
+ * changed.
+ */
 class DesktopWidget : public QWidget {
 public:
     DesktopWidget(QWidget* = nullptr);
     ~DesktopWidget() = default;
     void paintEvent(QPaintEvent*) override;
-    void updateDisplay(QImage const&);
+    /* changed: where frame differs from the one before */
+    void updateDisplay(std::shared_ptr<const QImage> const& frame, const QRegion& changed);
 private:
-    std::unique_ptr<QPixmap> currentImage;
-    bool haveImage = false;
+    std::shared_ptr<const QImage> currentImage; // borrowed from the renderer
 };
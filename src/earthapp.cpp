@@ -68,7 +68,14 @@
 #include "earthapp.h"
 #include "desktopwidget.h"
 #include "renderer.h"
+#include "renderthread.h"
+#include "rootpixmap.h"
 #include "file.h"
+#include "imageencoder.h"
+#include "mapcache.h"
+#include "publisher.h"
+#include "schedule.h"
+#include "tilestore.h"
 #include "moonpos.h"
 #include "command_line_parser.h"
 #include "geo_coordinate.h"
@@ -77,8 +84,6 @@
 #include <QString>
 #include <QDesktopWidget>
 #include <QDebug>
-#include <QProcess>
-#include <QtDBus/QtDBus>
 
 #include <cmath>
 
@@ -90,8 +95,9 @@ EarthApplication::EarthApplication(int &argc, char **argv)
     : QApplication(argc, argv),
       clp(new CommandLineParser(this)),
       marker_list(new MarkerList()),
+      encoder(new ImageEncoder(clp->getEncoder(), clp->getThreads())),
       out_file_name(clp->getOutputFileName().isEmpty()
-                    ? QString("xglobe-dump.png")
+                    ? QString("xglobe-dump.") + ImageEncoder::suffix(encoder->format())
                     : clp->getOutputFileName())
 {
     auto optNice =clp->getNice();
@@ -107,7 +113,10 @@ EarthApplication::EarthApplication(int &argc, char **argv)
 
 EarthApplication::~EarthApplication(void)
 {
-    timer->stop();
+    if (timer)
+        timer->stop();
+    if (render_thread)
+        render_thread->wait();
 }
 
 void EarthApplication::init()
@@ -115,30 +124,32 @@ void EarthApplication::init()
     const QSize size = clp->getSize();
     const QString mapFilename = clp->getMapFileName();
 
+    MapCache::setEnabled(clp->isMapCache());
+    if (clp->isMapCache())
+        MapCache::prune();
+    const int texmem = clp->getTextureMemory();
+    TileStore::setMemoryCap(texmem > 0 ? (size_t)texmem << 20 : 0);
+
     if (size.isValid()) {
-        r = std::make_unique<Renderer>(size, mapFilename);
+        r = std::make_unique<Renderer>(size);
     }
     else {
-        r = std::make_unique<Renderer>(clp->isDrawInWIndow() ? dwidget->size() : desktop()->size(),
-                                       mapFilename);
+        r = std::make_unique<Renderer>(clp->isDrawInWIndow() ? dwidget->size() : desktop()->size());
     }
 
-    /* initialize the Renderer */
-    const QString nightmapfile = clp->getNightMapfile();
-    if (clp->isNightmap() && !nightmapfile.isEmpty())
-        r->loadNightMap(nightmapfile);
-    else if (!mapFilename.isEmpty())
-        r->loadNightMap(mapFilename);
-
+    /* initialize the Renderer, the maps are read all at once */
+    Renderer::MapFiles maps;
+    maps.day = mapFilename;
+    if (clp->isNightmap())
+        maps.night = clp->getNightMapfile();
     const QString cloudmapfile= clp->getCloudMapFile();
-    if (!cloudmapfile.isEmpty())
-        r->loadCloudMap(cloudmapfile, clp->getCloudMapFilter());
-    else if (!mapFilename.isEmpty())
-        r->loadCloudMap(mapFilename, clp->getCloudMapFilter());
+    maps.cloud = cloudmapfile.isEmpty() ? mapFilename : cloudmapfile;
+    maps.cloud_filter = clp->getCloudMapFilter();
+    maps.back = clp->getBackGFileName();
+    maps.tiled_back = clp->isTiled();
+    r->setNightTint(clp->isNightTint());
+    r->loadMaps(maps);
 
-
-    if (!clp->getBackGFileName().isEmpty())
-        r->loadBackImage(clp->getBackGFileName(), clp->isTiled());
     r->setViewPos(clp->getGeoCoordinate()->getLatitude(), clp->getGeoCoordinate()->getLongitude());
     r->setZoom(clp->getMag());
     r->setAmbientRGB(clp->computeRgb());
@@ -170,8 +181,52 @@ void EarthApplication::init()
     r->setShift(std::get<0>(shift), std::get<1>(shift));
     r->setTransition(clp->getTransition());
     r->setRotation(clp->getRotation());
+    r->setSunRelative(clp->getGeoCoordinate()->getType() == PosType::sunrel);
+    r->setIncremental(clp->isIncremental());
+    r->setMipmap(clp->getMipmap());
+    r->setTextureLayout(clp->getTextureLayout());
+    r->setNumThreads(clp->getThreads());
+    if (!r->setKernel(clp->getKernel()))
+        r->setKernel(KernelType::automatic);
+
+    if (clp->isX11Root() && !clp->isDrawInWIndow() && !clp->isPlasma()) {
+        root_pixmap = std::make_unique<RootPixmap>();
+        if (!root_pixmap->isValid()) {
+            qWarning() << "Can't set the root window background, using xwallpaper";
+            root_pixmap.reset();
+        }
+    }
+
+    if (!clp->isDrawInWIndow()) {
+        const bool plasma = clp->isPlasma();
+        publisher = std::make_unique<Publisher>(plasma ? Publisher::Target::plasma : Publisher::Target::command,
+                                                clp->getImageTmpFileName(), *encoder, root_pixmap.get());
+#if defined(Q_OS_MACOS)
+        publisher->setCommand(clp->getXwallpaperExe(), QStringList() << clp->getImageTmpFileName());
+#else
+        publisher->setCommand(clp->getXwallpaperExe(), clp->getXWallpaperOptions(clp->getImageTmpFileName()));
+#endif
+        connect(publisher.get(), &Publisher::published, this, &EarthApplication::framePublished);
 
-    QTimer *timer = new QTimer(this);
+        // xwallpaper only reads png of the -encoder formats, Plasma goes by QImage
+        const ImageFormat format = encoder->format();
+        if (!root_pixmap && format != ImageFormat::png && (!plasma || format == ImageFormat::qoi)) {
+            qWarning() << "The wallpaper setter probably can't read" << ImageEncoder::suffix(format)
+                       << "files, try -encoder png";
+        }
+
+        // only publishing is left to do when the timer fires
+        render_ahead = clp->isRenderAhead();
+        if (render_ahead) {
+            r->setIdlePriority(true);
+            encoder->setIdlePriority();
+        }
+    }
+
+    render_thread = std::make_unique<RenderThread>(*r);
+    connect(render_thread.get(), SIGNAL(finished()), this, SLOT(frameRendered()));
+
+    timer = new QTimer(this);
     connect(timer, SIGNAL(timeout()), this, SLOT(recalc()));
     QTimer::singleShot(1, this, SLOT(recalc())); // this will start rendering
     timer->start(clp->getWait() * 1000); // the 1. image immediately
@@ -192,15 +247,58 @@ bool EarthApplication::adjustMarker()
 
 void EarthApplication::recalc()
 {
+    if (rendering || render_pending) {
+        qDebug() << "Frame not ready yet, skipping update";
+        late = rendering;
+        return;
+    }
+
     start_time = time(nullptr); // first image with current time
 
-    if (firstTime)
+    if (firstTime) {
         firstRecalc(start_time);
+        return;
+    }
 
     processImage();
+    renderNext();
+}
+
+// seconds, see nextInterval()
+static const double max_interval = 300.;
 
-    current_time = time(nullptr) + clp->getWait();
-    current_time = (time_t)(start_time + (current_time - start_time) * clp->getTimeWrap());
+/*
+ * Seconds until the next frame. With -adaptive that is when the globe
+ * will have changed by about a pixel, see Schedule. Never sooner than
+ * -wait or than a frame takes to render, never later than max_interval,
+ * clouds and markers may change too.
+ */
+double EarthApplication::nextInterval() const
+{
+    const double wait = clp->getWait();
+    if (!clp->isAdaptive())
+        return wait;
+
+    const double busy = render_ms / 1000.;
+    const PosType type = clp->getGeoCoordinate()->getType();
+    if (type == PosType::random || type == PosType::orbit)
+        return std::max(wait, busy);
+
+    // start_time is now, current_time what the last frame showed
+    return Schedule::interval(Schedule::pixelTime(r->getProjectedRadius()),
+        difftime(start_time, current_time), clp->getTimeWrap(), std::max(wait, busy), max_interval);
+}
+
+void EarthApplication::renderNext()
+{
+    start_time = time(nullptr);
+    const double interval = nextInterval();
+    if (clp->isAdaptive()) {
+        qDebug() << "Next frame in" << interval << "s";
+        timer->start(qRound(interval * 1000));
+    }
+
+    current_time = (time_t)(start_time + interval * clp->getTimeWrap());
     r->setTime(current_time);
     switch (clp->getGeoCoordinate()->getType()) {
     case PosType::fixed:
@@ -232,13 +330,17 @@ void EarthApplication::recalc()
         }
         break;
     }
-    r->renderFrame();
+    // with -renderahead the next frame waits until this one is up
+    if (render_ahead && publisher->isBusy())
+        render_pending = true;
+    else
+        startRender();
 }
 
 void EarthApplication::firstRecalc(time_t start_time)
 {
     firstTime = false;
-    processEvents();
+    current_time = start_time;
     r->setTime(start_time);
     switch (clp->getGeoCoordinate()->getType()) {
     case PosType::fixed:
@@ -270,20 +372,65 @@ void EarthApplication::firstRecalc(time_t start_time)
         }
         break;
     }
-    r->renderFrame();
+    startRender();
+}
 
+void EarthApplication::startRender()
+{
+    rendering = true;
+    render_time.start();
+    render_thread->start(render_ahead ? QThread::IdlePriority : QThread::InheritPriority);
+}
+
+void EarthApplication::frameRendered()
+{
+    rendering = false;
+    render_ms = render_time.elapsed();
+    qDebug() << "Rendered in" << render_ms << "ms";
+    if (late && clp->isAdaptive() && !firstFrame) {
+        // its time has passed, start over with one that is due later
+        qDebug() << "Dropping a late frame";
+        late = false;
+        renderNext();
+        return;
+    }
+    late = false;
+    if (!firstFrame) {
+        // shown on the next timer tick
+        if (render_ahead)
+            publisher->prepare(r->getImage());
+        return;
+    }
+
+    firstFrame = false;
+    if (clp->getBenchmarkFrames() > 0) {
+        r->benchmark(clp->getBenchmarkFrames());
+        exit(0);
+    }
     if (clp->isDumpToFile()) {
-        r->getImage()->save(out_file_name, "PNG");
+        encoder->save(*r->getImage(), out_file_name);
         exit(0);
     }
+    // show the first image right away and start on the next one
+    recalc();
+}
+
+void EarthApplication::framePublished()
+{
+    if (clp->isOnce())
+        exit(0);
+    if (render_pending) {
+        render_pending = false;
+        startRender();
+    }
 }
 
 void EarthApplication::processImage()
 {
+    // borrowed from the renderer, not copied
+    const auto frame = r->getImage();
     if (clp->isDrawInWIndow()) {
-        r->getImage()->save(clp->getImageTmpFileName(), "PNG");
-        dwidget->updateDisplay(*r->getImage());
-        dwidget->update();
+        dwidget->updateDisplay(frame, r->takeChangedRegion());
         processEvents(); // we want the image to be
     } // displayed immediately
     /* NOT yet
@@ -295,52 +442,7 @@ void EarthApplication::processImage()
         }
     }
     */
-    else if (clp->isPlasma()) {
-
-        if (!QDBusConnection::sessionBus().isConnected()) {
-            qCritical() << "Cannot connect to the D-Bus session bus.";
-            return;
-        }
-
-        QDBusInterface iface("org.kde.plasmashell", "/PlasmaShell", "org.kde.PlasmaShell");
-        if (iface.isValid()) {
-            r->getImage()->save(clp->getImageTmpFileName(), "PNG");
-            // NOTE: KDE 5 API is still changing, it may not work on all KDE versions
-            QString script;
-            script += "var allDesktops=desktops();";
-            script += "for(var i=0;i<allDesktops.length;i++){";
-            script += "  var d=allDesktops[i];";
-            script += "  d.wallpaperPlugin=\"org.kde.image\";";
-            script += "  d.currentConfigGroup=Array(\"Wallpaper\",\"org.kde.image\",\"General\");";
-            script += "  d.writeConfig(\"Image\",\"file://";
-            script += clp->getImageTmpFileName();
-            script += "\");";
-            script += "}";
-            iface.call(QLatin1String("evaluateScript"), script);
-            return;
-        }
-    } // displayed immediately
     else {
-        r->getImage()->save(clp->getImageTmpFileName(), "PNG");
-
-        QStringList arguments;
- #if defined(Q_OS_MACOS)
-        arguments << clp->getImageTmpFileName();
-#else
-        arguments << clp->getXWallpaperOptions(clp->getImageTmpFileName());
-#endif
-
-        qDebug() << "QProcess: " << clp->getXwallpaperExe() << arguments;
-
-        QProcess runXwallpaper(this);
-        runXwallpaper.start(clp->getXwallpaperExe(), arguments);
-
-        if (!runXwallpaper.waitForFinished())
-            qCritical() << "failed to execute xwallpaper: " << runXwallpaper.errorString();
-
-        if (clp->isOnce()) {
-            processEvents();
-            exit(0);
-        }
+        publisher->publish(frame);
     }
 }
@@ -58,6 +58,7 @@
 #pragma once
 
 #include <QApplication>
+#include <QElapsedTimer>
 
 #include "markerlist.h"
 
@@ -65,11 +66,15 @@
 #include <memory>
 
 class Renderer;
+class RenderThread;
 class DesktopWidget;
 class QTimer;
 class QSize;
 class QString;
 class CommandLineParser;
+class ImageEncoder;
+class RootPixmap;
+class Publisher;
 
 class EarthApplication : public QApplication {
     Q_OBJECT
@@ -83,12 +88,19 @@ public:
 private:
 
     void firstRecalc(time_t);
+    void startRender();
+    void renderNext();
+    double nextInterval() const;
     void processImage();
     bool adjustMarker();
 
 public slots:
     void recalc();
 
+private slots:
+    void frameRendered();
+    void framePublished();
+
 protected:
 
     bool builtin_markers = true;
@@ -117,10 +129,21 @@ private:
     std::unique_ptr<CommandLineParser> clp;
     TMarkerListPtr marker_list;
     std::unique_ptr<Renderer> r;
+    std::unique_ptr<RenderThread> render_thread;
     std::unique_ptr<DesktopWidget> dwidget;
+    std::unique_ptr<ImageEncoder> encoder;
+    std::unique_ptr<RootPixmap> root_pixmap;
+    std::unique_ptr<Publisher> publisher;
     QTimer* timer = nullptr;
     QString out_file_name;
+    QElapsedTimer render_time;
+    qint64 render_ms = 0; // the last frame took
 
     bool firstTime = true;
+    bool firstFrame = true;
+    bool rendering = false;
     bool do_dumpcmd = false;
+    bool render_ahead = false; // see recalc()
+    bool render_pending = false; // until the last frame is published
+    bool late = false; // the frame being rendered missed its tick
 };
@@ -0,0 +1,70 @@
+#include "framering.h"
+
+#include <QDebug>
+#include <cstring>
+
+FrameRing::FrameRing(const QSize& size, QImage::Format f)
+    : frame_size(size)
+    , format(f)
+    , drawing(0)
+    , shown(0)
+{
+    for (auto& frame : frames) {
+        frame = std::make_shared<QImage>(size, format);
+        frame->fill(0);
+    }
+}
+
+QSize FrameRing::size() const
+{
+    return frame_size;
+}
+
+QImage& FrameRing::begin(bool keep)
+{
+    std::lock_guard<std::mutex> hold(lock);
+
+    // only latest() copies the pointers, and only while holding the lock
+    int next = -1;
+    for (int i = 0; i < count && next < 0; i++) {
+        if (i != shown && frames[i].use_count() == 1)
+            next = i;
+    }
+    if (next < 0) {
+        // the borrowers keep the old buffer alive
+        next = (shown + 1) % count;
+        qDebug() << "All frame buffers borrowed, allocating another one";
+        frames[next] = std::make_shared<QImage>(frame_size, format);
+        behind[next] = QRegion(0, 0, frame_size.width(), frame_size.height());
+    }
+    drawing = next;
+
+    QImage& frame = *frames[drawing];
+    if (keep) {
+        const QImage& last = *frames[shown];
+        const int bytes = frame.depth() / 8;
+        for (const QRect& r : behind[next]) {
+            for (int y = r.top(); y <= r.bottom(); y++)
+                memcpy(frame.scanLine(y) + r.left() * bytes, last.constScanLine(y) + r.left() * bytes,
+                    (size_t)r.width() * bytes);
+        }
+    }
+    return frame;
+}
+
+void FrameRing::finish(const QRegion& damage)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    for (int i = 0; i < count; i++) {
+        if (i != drawing)
+            behind[i] += damage;
+    }
+    behind[drawing] = QRegion();
+    shown = drawing;
+}
+
+std::shared_ptr<const QImage> FrameRing::latest() const
+{
+    std::lock_guard<std::mutex> hold(lock);
+    return frames[shown];
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QImage>
+#include <QRegion>
+#include <QSize>
+#include <memory>
+#include <mutex>
+
+/*
+ * The few frame buffers the renderer takes turns drawing into, allocated
+ * once. begin() hands out a buffer that is neither the last finished
+ * frame nor borrowed, finish() makes it the last finished frame.
+ *
+ * latest() lends the last finished frame out without copying, it isn't
+ * drawn into again until every copy of the pointer is gone. Copying the
+ * QImage itself would share its data, and the next frame drawn into it
+ * would detach, so keep the pointer instead. latest() may be called from
+ * any thread, even while a frame is being drawn.
+ */
+class FrameRing {
+public:
+    static const int count = 3;
+
+    FrameRing(const QSize& size, QImage::Format format);
+
+    QSize size() const;
+    /* keep: start out with a copy of the last finished frame, only the
+     * parts the buffer missed since it was last drawn into are copied */
+    QImage& begin(bool keep);
+    /* damage: what the frame changed compared to the last finished one */
+    void finish(const QRegion& damage);
+    std::shared_ptr<const QImage> latest() const;
+
+private:
+    QSize frame_size;
+    QImage::Format format;
+    std::shared_ptr<QImage> frames[count];
+    QRegion behind[count]; // changed by the frames finished since it was drawn
+    int drawing; // the one begin() handed out
+    int shown; // the last finished one
+    mutable std::mutex lock;
+
+    // don't want to bother with copy
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+};
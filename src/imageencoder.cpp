@@ -0,0 +1,454 @@
+#include "imageencoder.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QtEndian>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+namespace {
+
+const size_t strip_bytes = 1 << 20; // of filtered rows per deflate job
+const unsigned int window = 1 << 15; // deflate history
+
+void put32(unsigned char* p, quint32 v)
+{
+    qToBigEndian(v, p);
+}
+
+bool writeChunk(QIODevice& out, const char* type, const unsigned char* data, quint32 length)
+{
+    unsigned char head[8];
+    put32(head, length);
+    memcpy(head + 4, type, 4);
+    uLong crc = crc32(0, head + 4, 4);
+    if (length) // crc32() of nullptr is the initial value
+        crc = crc32(crc, data, length);
+    unsigned char tail[4];
+    put32(tail, crc);
+    return out.write(reinterpret_cast<const char*>(head), 8) == 8
+        && (!length || out.write(reinterpret_cast<const char*>(data), length) == (qint64)length)
+        && out.write(reinterpret_cast<const char*>(tail), 4) == 4;
+}
+
+void rgbRow(const QImage& image, int y, unsigned char* rgb)
+{
+    const QRgb* p = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+    for (int x = 0; x < image.width(); x++) {
+        rgb[3 * x] = qRed(p[x]);
+        rgb[3 * x + 1] = qGreen(p[x]);
+        rgb[3 * x + 2] = qBlue(p[x]);
+    }
+}
+
+inline unsigned char paeth(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+/* one filtered PNG row of n bytes with 3 bytes per pixel, type byte first */
+void filterRow(PngFilter f, const unsigned char* cur, const unsigned char* prior, size_t n,
+    unsigned char* out)
+{
+    const int bpp = 3;
+    out[0] = (unsigned char)f;
+    out++;
+    switch (f) {
+    case PngFilter::none:
+        memcpy(out, cur, n);
+        break;
+    case PngFilter::sub:
+        for (size_t i = 0; i < n; i++)
+            out[i] = cur[i] - (i >= bpp ? cur[i - bpp] : 0);
+        break;
+    case PngFilter::up:
+        for (size_t i = 0; i < n; i++)
+            out[i] = cur[i] - prior[i];
+        break;
+    case PngFilter::average:
+        for (size_t i = 0; i < n; i++)
+            out[i] = cur[i] - (((i >= bpp ? cur[i - bpp] : 0) + prior[i]) >> 1);
+        break;
+    default:
+        for (size_t i = 0; i < n; i++) {
+            const int a = i >= bpp ? cur[i - bpp] : 0;
+            const int c = i >= bpp ? prior[i - bpp] : 0;
+            out[i] = cur[i] - paeth(a, prior[i], c);
+        }
+        break;
+    }
+}
+
+/* the usual heuristic: small differences, taken as signed, pack best */
+size_t rowCost(const unsigned char* row, size_t n)
+{
+    size_t sum = 0;
+    for (size_t i = 1; i <= n; i++)
+        sum += row[i] < 128 ? row[i] : 256 - row[i];
+    return sum;
+}
+
+}
+
+ImageEncoder::ImageEncoder(const EncoderSettings& s, int threads)
+    : settings(s)
+    , pool(threads)
+{
+    settings.level = std::min(std::max(settings.level, 0), 9);
+}
+
+void ImageEncoder::setIdlePriority()
+{
+    pool.setIdlePriority();
+}
+
+ImageFormat ImageEncoder::format() const
+{
+    return settings.format;
+}
+
+QString ImageEncoder::suffix(ImageFormat format)
+{
+    switch (format) {
+    case ImageFormat::ppm:
+        return QString("ppm");
+    case ImageFormat::bmp:
+        return QString("bmp");
+    case ImageFormat::qoi:
+        return QString("qoi");
+    default:
+        return QString("png");
+    }
+}
+
+bool ImageEncoder::save(const QImage& frame, const QString& name)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // the renderer always hands out RGB32
+    QImage converted;
+    const QImage* image = &frame;
+    if (frame.format() != QImage::Format_RGB32 && frame.format() != QImage::Format_ARGB32) {
+        converted = frame.convertToFormat(QImage::Format_RGB32);
+        image = &converted;
+    }
+
+    QSaveFile file(name);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write" << name << ":" << file.errorString();
+        return false;
+    }
+
+    bool ok = false;
+    switch (settings.format) {
+    case ImageFormat::png:
+        ok = writePng(*image, file);
+        break;
+    case ImageFormat::ppm:
+        ok = writePpm(*image, file);
+        break;
+    case ImageFormat::bmp:
+        ok = writeBmp(*image, file);
+        break;
+    case ImageFormat::qoi:
+        ok = writeQoi(*image, file);
+        break;
+    }
+    if (!ok || !file.commit()) {
+        qWarning() << "Can't write" << name << ":" << file.errorString();
+        return false;
+    }
+
+    qDebug() << "Saved" << name << "as" << suffix(settings.format) << "in"
+             << timer.elapsed() << "ms";
+    return true;
+}
+
+/*
+ * Rows y0 to y1 - 1 of the image as filtered RGB into pixels.
+ */
+void ImageEncoder::filterRows(const QImage& image, int y0, int y1)
+{
+    const size_t n = (size_t)image.width() * 3;
+    thread_local std::vector<unsigned char> cur, prior, trial;
+    cur.resize(n);
+    prior.assign(n, 0);
+    trial.resize(n + 1);
+    if (y0 > 0)
+        rgbRow(image, y0 - 1, prior.data());
+
+    for (int y = y0; y < y1; y++) {
+        rgbRow(image, y, cur.data());
+        unsigned char* out = pixels.data() + (size_t)y * (n + 1);
+        if (settings.filter != PngFilter::adaptive) {
+            filterRow(settings.filter, cur.data(), prior.data(), n, out);
+        }
+        else {
+            size_t best = SIZE_MAX;
+            for (PngFilter f : { PngFilter::none, PngFilter::sub, PngFilter::up,
+                     PngFilter::average, PngFilter::paeth }) {
+                filterRow(f, cur.data(), prior.data(), n, trial.data());
+                const size_t cost = rowCost(trial.data(), n);
+                if (cost < best) {
+                    best = cost;
+                    memcpy(out, trial.data(), n + 1);
+                }
+            }
+        }
+        std::swap(cur, prior);
+    }
+}
+
+/*
+ * 8 bit RGB. The strips are deflated as raw streams ending on a byte
+ * boundary, so that one after the other they are a single zlib stream,
+ * and each one is written as an IDAT chunk of its own.
+ */
+bool ImageEncoder::writePng(const QImage& image, QIODevice& out)
+{
+    const int w = image.width();
+    const int h = image.height();
+    const size_t row_bytes = (size_t)w * 3 + 1;
+    const int strip_rows = std::max((int)(strip_bytes / row_bytes), 1);
+    const int count = (h + strip_rows - 1) / strip_rows;
+    if (count == 0)
+        return false;
+
+    pixels.resize(row_bytes * h);
+    strips.resize(count);
+    std::vector<uLong> adler(count);
+    std::vector<uLong> crc(count);
+
+    // filters look at the row above, filter everything before deflating
+    pool.run(count, [&](size_t i, int) {
+        filterRows(image, i * strip_rows, std::min((int)(i + 1) * strip_rows, h));
+    });
+
+    // zlib header, flagged with the level like zlib itself does
+    const int flevel = settings.level < 2 ? 0 : settings.level < 6 ? 1 : settings.level == 6 ? 2 : 3;
+    unsigned char header[2] = { 0x78, (unsigned char)(flevel << 6) };
+    header[1] += 31 - (header[0] * 256 + header[1]) % 31;
+
+    const int strategy = settings.filter == PngFilter::none ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    std::atomic<bool> deflated(true);
+    pool.run(count, [&](size_t i, int) {
+        const unsigned char* in = pixels.data() + i * strip_rows * row_bytes;
+        const size_t length = std::min((size_t)strip_rows, (size_t)h - i * strip_rows) * row_bytes;
+        const bool last = (int)i == count - 1;
+
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        if (deflateInit2(&z, settings.level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+            deflated = false;
+            return;
+        }
+        if (i > 0) {
+            const size_t dict = std::min<size_t>(window, i * strip_rows * row_bytes);
+            deflateSetDictionary(&z, in - dict, dict);
+        }
+
+        std::vector<unsigned char>& strip = strips[i];
+        strip.resize(deflateBound(&z, length) + 16);
+        z.next_in = const_cast<unsigned char*>(in);
+        z.avail_in = length;
+        z.next_out = strip.data();
+        z.avail_out = strip.size();
+        int result;
+        for (;;) {
+            result = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (z.avail_out != 0 || result == Z_STREAM_END || result == Z_STREAM_ERROR)
+                break;
+            // not expected with deflateBound(), but the sync marker isn't in it
+            const size_t done = strip.size();
+            strip.resize(done * 2);
+            z.next_out = strip.data() + done;
+            z.avail_out = strip.size() - done;
+        }
+        strip.resize(z.total_out);
+        deflateEnd(&z);
+        if (result == Z_STREAM_ERROR || (last && result != Z_STREAM_END)) {
+            deflated = false;
+            return;
+        }
+
+        adler[i] = adler32(adler32(0, nullptr, 0), in, length);
+        const unsigned char type[4] = { 'I', 'D', 'A', 'T' };
+        uLong c = crc32(0, type, 4);
+        if (i == 0)
+            c = crc32(c, header, 2);
+        crc[i] = crc32(c, strip.data(), strip.size());
+    });
+    if (!deflated)
+        return false;
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char ihdr[13];
+    put32(ihdr, w);
+    put32(ihdr + 4, h);
+    ihdr[8] = 8; // bits per channel
+    ihdr[9] = 2; // RGB
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    bool ok = out.write(reinterpret_cast<const char*>(signature), 8) == 8
+        && writeChunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+    uLong sum = adler[0];
+    for (int i = 0; ok && i < count; i++) {
+        const std::vector<unsigned char>& strip = strips[i];
+        const bool first = i == 0;
+        const bool last = i == count - 1;
+        if (!first)
+            sum = adler32_combine(sum, adler[i], std::min(strip_rows, h - i * strip_rows) * row_bytes);
+
+        // the chunk holds the zlib header before the first strip and the
+        // checksum after the last
+        unsigned char head[8];
+        put32(head, strip.size() + (first ? 2 : 0) + (last ? 4 : 0));
+        memcpy(head + 4, "IDAT", 4);
+        unsigned char trailer[4];
+        put32(trailer, sum);
+        unsigned char tail[4];
+        put32(tail, last ? crc32(crc[i], trailer, 4) : crc[i]);
+        ok = out.write(reinterpret_cast<const char*>(head), 8) == 8
+            && (!first || out.write(reinterpret_cast<const char*>(header), 2) == 2)
+            && out.write(reinterpret_cast<const char*>(strip.data()), strip.size()) == (qint64)strip.size()
+            && (!last || out.write(reinterpret_cast<const char*>(trailer), 4) == 4)
+            && out.write(reinterpret_cast<const char*>(tail), 4) == 4;
+    }
+    return ok && writeChunk(out, "IEND", nullptr, 0);
+}
+
+bool ImageEncoder::writePpm(const QImage& image, QIODevice& out)
+{
+    const size_t row_bytes = (size_t)image.width() * 3;
+    pixels.resize(row_bytes * image.height());
+    pool.run(image.height(), [&](size_t y, int) {
+        rgbRow(image, y, pixels.data() + y * row_bytes);
+    });
+
+    const QByteArray header = QString("P6\n%1 %2\n255\n").arg(image.width()).arg(image.height()).toLatin1();
+    return out.write(header) == header.size()
+        && out.write(reinterpret_cast<const char*>(pixels.data()), pixels.size()) == (qint64)pixels.size();
+}
+
+/*
+ * 32 bit top down BMP, the rows of RGB32 are written as they are.
+ */
+bool ImageEncoder::writeBmp(const QImage& image, QIODevice& out)
+{
+    const quint32 row_bytes = image.width() * 4;
+    const quint32 data = row_bytes * image.height();
+    unsigned char header[54];
+    memset(header, 0, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    qToLittleEndian<quint32>(sizeof(header) + data, header + 2);
+    qToLittleEndian<quint32>(sizeof(header), header + 10);
+    qToLittleEndian<quint32>(40, header + 14); // BITMAPINFOHEADER
+    qToLittleEndian<qint32>(image.width(), header + 18);
+    qToLittleEndian<qint32>(-image.height(), header + 22); // top down
+    qToLittleEndian<quint16>(1, header + 26); // planes
+    qToLittleEndian<quint16>(32, header + 28); // bits per pixel
+    qToLittleEndian<quint32>(data, header + 34);
+    if (out.write(reinterpret_cast<const char*>(header), sizeof(header)) != sizeof(header))
+        return false;
+
+    for (int y = 0; y < image.height(); y++) {
+        const char* row = reinterpret_cast<const char*>(image.constScanLine(y));
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        pixels.resize(row_bytes);
+        qToLittleEndian<quint32>(row, image.width(), pixels.data());
+        row = reinterpret_cast<const char*>(pixels.data());
+#endif
+        if (out.write(row, row_bytes) != row_bytes)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * The Quite OK Image format, see qoiformat.org. Every pixel depends on
+ * the ones before, so this one runs on a single thread.
+ */
+bool ImageEncoder::writeQoi(const QImage& image, QIODevice& out)
+{
+    const int w = image.width();
+    const int h = image.height();
+    pixels.resize(14 + (size_t)w * h * 4 + 8);
+    unsigned char* p = pixels.data();
+
+    memcpy(p, "qoif", 4);
+    put32(p + 4, w);
+    put32(p + 8, h);
+    p[12] = 3; // RGB
+    p[13] = 0; // sRGB
+    p += 14;
+
+    QRgb index[64];
+    memset(index, 0, sizeof(index));
+    QRgb prev = qRgb(0, 0, 0);
+    int run = 0;
+    for (int y = 0; y < h; y++) {
+        const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < w; x++) {
+            const QRgb c = line[x] | 0xff000000;
+            if (c == prev) {
+                if (++run == 62) {
+                    *p++ = 0xc0 | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *p++ = 0xc0 | (run - 1);
+                run = 0;
+            }
+            const int r = qRed(c), g = qGreen(c), b = qBlue(c);
+            const int i = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+            if (index[i] == c) {
+                *p++ = i;
+            }
+            else {
+                index[i] = c;
+                // differences wrap around like in the reference encoder
+                const signed char dr = r - qRed(prev);
+                const signed char dg = g - qGreen(prev);
+                const signed char db = b - qBlue(prev);
+                const signed char dr_dg = dr - dg;
+                const signed char db_dg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *p++ = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                }
+                else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    *p++ = 0x80 | (dg + 32);
+                    *p++ = (dr_dg + 8) << 4 | (db_dg + 8);
+                }
+                else {
+                    *p++ = 0xfe;
+                    *p++ = r;
+                    *p++ = g;
+                    *p++ = b;
+                }
+            }
+            prev = c;
+        }
+    }
+    if (run)
+        *p++ = 0xc0 | (run - 1);
+    static const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    memcpy(p, end, 8);
+    p += 8;
+
+    const qint64 size = p - pixels.data();
+    return out.write(reinterpret_cast<const char*>(pixels.data()), size) == size;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "workpool.h"
+
+#include <QImage>
+#include <QString>
+#include <vector>
+
+class QIODevice;
+
+/* file format of the saved frames */
+enum class ImageFormat { png, ppm, bmp, qoi };
+
+/* PNG row filter: always the same one, or per row the one that leaves
+ * the smallest differences, like libpng does */
+enum class PngFilter { none, sub, up, average, paeth, adaptive };
+
+struct EncoderSettings {
+    ImageFormat format = ImageFormat::png;
+    int level = 6; // zlib compression level of PNG, 0 to 9
+    PngFilter filter = PngFilter::adaptive;
+};
+
+/*
+ * Writes the rendered frames for the wallpaper setters, faster than
+ * QImage::save(). PNG is filtered and deflated in strips of rows on all
+ * threads, each strip primed with the end of the one before so the file
+ * is hardly larger than from a single stream. PPM and BMP are not
+ * compressed at all, QOI compresses a little in a single fast pass.
+ *
+ * The buffers are kept for the next frame of the same size. Files are
+ * replaced atomically, a wallpaper setter never reads half a frame.
+ */
+class ImageEncoder {
+public:
+    explicit ImageEncoder(const EncoderSettings& settings = EncoderSettings(), int threads = 0);
+
+    bool save(const QImage& image, const QString& name);
+    void setIdlePriority(); // of the threads helping out, see WorkPool
+
+    ImageFormat format() const;
+    static QString suffix(ImageFormat format);
+
+private:
+    bool writePng(const QImage& image, QIODevice& out);
+    bool writePpm(const QImage& image, QIODevice& out);
+    bool writeBmp(const QImage& image, QIODevice& out);
+    bool writeQoi(const QImage& image, QIODevice& out);
+    void filterRows(const QImage& image, int y0, int y1);
+
+    EncoderSettings settings;
+    WorkPool pool;
+    std::vector<unsigned char> pixels; // filtered or converted rows
+    std::vector<std::vector<unsigned char>> strips; // deflated
+};
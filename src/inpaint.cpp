@@ -0,0 +1,118 @@
+#include "inpaint.h"
+#include "workpool.h"
+
+#include <QColor>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const int none = -1;
+const int column_block = 64; // columns per job of the first pass
+
+/*
+ * For every texel the closest valid row in its column, none if the
+ * column has no valid texel at all.
+ */
+void nearestInColumns(const std::vector<unsigned char>& valid, int w, int h, int x0, int x1,
+    std::vector<int>& near)
+{
+    for (int x = x0; x < x1; x++)
+        near[x] = valid[x] ? 0 : none;
+    for (int y = 1; y < h; y++) {
+        const size_t row = (size_t)y * w;
+        for (int x = x0; x < x1; x++)
+            near[row + x] = valid[row + x] ? y : near[row - w + x];
+    }
+    for (int y = h - 2; y >= 0; y--) {
+        const size_t row = (size_t)y * w;
+        for (int x = x0; x < x1; x++) {
+            const int below = near[row + w + x];
+            const int here = near[row + x];
+            // only take the one below if strictly closer
+            if (below != none && (here == none || below - y < y - here))
+                near[row + x] = below;
+        }
+    }
+}
+
+/*
+ * Lower envelope of the parabolas (x - q)^2 + dy(q)^2 over the columns
+ * q of the row, each column once on either side as well, as far as it
+ * can be the closest one of some texel of the row.
+ */
+void nearestInRow(unsigned char* bits, int bytes_per_line, int w,
+    const std::vector<unsigned char>& valid, const std::vector<int>& near, int y)
+{
+    const size_t row = (size_t)y * w;
+    if (std::find(valid.begin() + row, valid.begin() + row + w, 0) == valid.begin() + row + w)
+        return; // nothing to fill
+
+    // the envelope, over the columns -w/2 .. 3w/2
+    thread_local std::vector<int> site;
+    thread_local std::vector<double> site_h; // dy^2 + q^2
+    thread_local std::vector<double> from; // where each one starts to be the lowest
+    site.clear();
+    site_h.clear();
+    from.clear();
+
+    for (int q = -w / 2; q < w + w / 2; q++) {
+        const int sx = q < 0 ? q + w : (q >= w ? q - w : q);
+        const int n = near[row + sx];
+        if (n == none)
+            continue;
+        const double hq = (double)(n - y) * (n - y) + (double)q * q;
+        double s = -std::numeric_limits<double>::infinity();
+        while (!site.empty()) {
+            s = (hq - site_h.back()) / (2. * (q - site.back()));
+            if (s > from.back())
+                break;
+            site.pop_back();
+            site_h.pop_back();
+            from.pop_back();
+            s = -std::numeric_limits<double>::infinity();
+        }
+        site.push_back(q);
+        site_h.push_back(hq);
+        from.push_back(s);
+    }
+    if (site.empty())
+        return; // nothing valid anywhere
+
+    QRgb* line = reinterpret_cast<QRgb*>(bits + (size_t)y * bytes_per_line);
+    size_t k = 0;
+    for (int x = 0; x < w; x++) {
+        while (k + 1 < site.size() && from[k + 1] <= x)
+            k++;
+        if (valid[row + x])
+            continue;
+        const int q = site[k];
+        const int sx = q < 0 ? q + w : (q >= w ? q - w : q);
+        const int sy = near[row + sx];
+        // valid texels are never written, reading other rows is safe
+        line[x] = reinterpret_cast<const QRgb*>(bits + (size_t)sy * bytes_per_line)[sx];
+    }
+}
+
+}
+
+void fillFromNearest(QImage& image, const std::vector<unsigned char>& valid, WorkPool& pool)
+{
+    const int w = image.width();
+    const int h = image.height();
+    if (w <= 0 || h <= 0)
+        return;
+
+    std::vector<int> near((size_t)w * h);
+    pool.run((w + column_block - 1) / column_block, [&](size_t i, int) {
+        const int x0 = i * column_block;
+        nearestInColumns(valid, w, h, x0, std::min(x0 + column_block, w), near);
+    });
+    // detach once up front, not from several threads
+    unsigned char* bits = image.bits();
+    const int bytes_per_line = image.bytesPerLine();
+    pool.run(h, [&](size_t y, int) {
+        nearestInRow(bits, bytes_per_line, w, valid, near, y);
+    });
+}
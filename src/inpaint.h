@@ -0,0 +1,19 @@
+#pragma once
+
+#include <QImage>
+#include <vector>
+
+class WorkPool;
+
+/*
+ * Replace every texel of a 32 bit map whose entry in valid is 0 by the
+ * closest texel whose entry isn't, by Euclidean distance in texels, with
+ * the map wrapping around horizontally. Ties are always broken the same
+ * way, the result doesn't depend on the number of threads.
+ *
+ * This is the exact distance transform of Felzenszwalb and Huttenlocher,
+ * keeping the position of the closest texel along with the distance:
+ * one pass down the columns, one along the rows, each linear in the
+ * number of texels and split over the pool.
+ */
+void fillFromNearest(QImage& image, const std::vector<unsigned char>& valid, WorkPool& pool);
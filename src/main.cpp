@@ -27,9 +27,11 @@
  */
 
 #include "earthapp.h"
+#include "rootpixmap.h"
 
 int main(int argc, char** argv)
 {
+    RootPixmap::initThreads();
     EarthApplication app(argc, argv);
     app.init();
     return app.exec();
@@ -0,0 +1,242 @@
+#include "mapcache.h"
+#include "file.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QVector>
+#include <cstring>
+
+namespace {
+
+const char cache_magic[8] = { 'X', 'G', 'L', 'O', 'B', 'E', 'M', 'P' };
+const quint32 cache_version = 2;
+const qint64 page_size = 4096;
+
+struct CacheHeader {
+    char magic[8];
+    quint32 version;
+    quint32 format; // QImage::Format
+    qint32 width;
+    qint32 height;
+    qint32 bytes_per_line;
+    qint32 colors; // entries of the color table after the header
+    qint64 source_size;
+    qint64 source_mtime; // ms since the epoch, 0 for derived images
+    char source_hash[20]; // sha1 of the content, derived images only
+    qint64 data_offset; // of the first pixel row
+};
+
+void unmapCache(void* file)
+{
+    delete static_cast<QFile*>(file); // unmaps as well
+}
+
+}
+
+bool MapCache::enabled = true;
+
+void MapCache::setEnabled(bool on)
+{
+    enabled = on;
+}
+
+bool MapCache::isEnabled()
+{
+    return enabled;
+}
+
+QString MapCache::cacheDir()
+{
+    return FileChange::getHomePath() + QLatin1String("cache");
+}
+
+QString MapCache::cacheFile(const QString& path, const char* suffix)
+{
+    const QByteArray key = QFileInfo(path).absoluteFilePath().toUtf8();
+    return cacheDir() + QDir::separator()
+        + QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex().constData())
+        + QLatin1String(suffix);
+}
+
+/*
+ * The modification time of a cache file is when it was last used, the
+ * content never changes after writing.
+ */
+void MapCache::markUsed(QFileDevice& file)
+{
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+}
+
+void MapCache::prune(int max_age_days)
+{
+    const QDateTime oldest = QDateTime::currentDateTime().addDays(-max_age_days);
+    for (const QFileInfo& info : QDir(cacheDir()).entryInfoList(QDir::Files)) {
+        if (info.lastModified() >= oldest)
+            continue;
+        if (QFile::remove(info.absoluteFilePath()))
+            qDebug() << "Removed unused map cache" << info.fileName();
+    }
+}
+
+/* what a cache file has to match */
+struct MapCache::Source {
+    qint64 size;
+    qint64 mtime;
+    QByteArray hash;
+};
+
+std::shared_ptr<QImage> MapCache::load(const QString& path)
+{
+    const QFileInfo source(path);
+    if (!enabled || !source.exists())
+        return nullptr;
+    const Source s = { source.size(), source.lastModified().toMSecsSinceEpoch(), QByteArray(20, 0) };
+    auto image = read(cacheFile(path), s);
+    if (image)
+        qDebug() << "Map from cache:" << path;
+    return image;
+}
+
+bool MapCache::store(const QString& path, const QImage& image)
+{
+    const QFileInfo source(path);
+    if (!enabled || !source.exists())
+        return false;
+    const Source s = { source.size(), source.lastModified().toMSecsSinceEpoch(), QByteArray(20, 0) };
+    if (!write(cacheFile(path), s, image))
+        return false;
+    qDebug() << "Map cached:" << path;
+    return true;
+}
+
+MapCache::Content MapCache::readContent(const QString& path)
+{
+    Content content;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return content;
+    content.data = file.readAll();
+    if (!content.data.isEmpty())
+        content.hash = QCryptographicHash::hash(content.data, QCryptographicHash::Sha1);
+    return content;
+}
+
+std::shared_ptr<QImage> MapCache::loadDerived(const QString& path, const Content& content,
+    const QString& variant)
+{
+    if (!enabled || content.hash.isEmpty())
+        return nullptr;
+    const Source s = { content.data.size(), 0, content.hash };
+    auto image = read(cacheFile(path, ".") + variant, s);
+    if (image)
+        qDebug() << "Map from cache:" << path << variant;
+    return image;
+}
+
+bool MapCache::storeDerived(const QString& path, const Content& content, const QString& variant,
+    const QImage& image)
+{
+    if (!enabled || content.hash.isEmpty())
+        return false;
+    const Source s = { content.data.size(), 0, content.hash };
+    if (!write(cacheFile(path, ".") + variant, s, image))
+        return false;
+    qDebug() << "Map cached:" << path << variant;
+    return true;
+}
+
+std::shared_ptr<QImage> MapCache::read(const QString& name, const Source& source)
+{
+    auto file = std::make_unique<QFile>(name);
+    if (!file->open(QIODevice::ReadOnly))
+        return nullptr;
+
+    const qint64 size = file->size();
+    if (size < (qint64)sizeof(CacheHeader))
+        return nullptr;
+    const uchar* data = file->map(0, size);
+    if (!data)
+        return nullptr;
+
+    CacheHeader h;
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, cache_magic, sizeof(cache_magic)) != 0 || h.version != cache_version)
+        return nullptr;
+    if (h.source_size != source.size || h.source_mtime != source.mtime
+        || memcmp(h.source_hash, source.hash.constData(), sizeof(h.source_hash)) != 0) {
+        qDebug() << "Map cache out of date:" << name;
+        return nullptr;
+    }
+    if (h.width <= 0 || h.height <= 0 || h.colors < 0 || h.colors > 256
+        || h.data_offset < (qint64)(sizeof(h) + h.colors * sizeof(QRgb))
+        || h.data_offset + (qint64)h.bytes_per_line * h.height > size)
+        return nullptr;
+
+    const QImage::Format format = (QImage::Format)h.format;
+    if (format != QImage::Format_RGB32 && format != QImage::Format_ARGB32
+        && format != QImage::Format_Indexed8 && format != QImage::Format_Grayscale8)
+        return nullptr;
+
+    QVector<QRgb> colors(h.colors);
+    memcpy(colors.data(), data + sizeof(h), h.colors * sizeof(QRgb));
+
+    markUsed(*file);
+    // from here on the image owns the mapping
+    auto image = std::make_shared<QImage>(data + h.data_offset, h.width, h.height,
+        h.bytes_per_line, format, unmapCache, file.release());
+    if (h.colors)
+        image->setColorTable(colors);
+    return image;
+}
+
+bool MapCache::write(const QString& name, const Source& source, const QImage& image)
+{
+    if (image.isNull())
+        return false;
+
+    const QImage::Format format = image.format();
+    if (format != QImage::Format_RGB32 && format != QImage::Format_ARGB32
+        && format != QImage::Format_Indexed8 && format != QImage::Format_Grayscale8)
+        return false;
+
+    QDir().mkpath(QFileInfo(name).absolutePath());
+
+    const QVector<QRgb> colors = image.colorTable();
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, cache_magic, sizeof(cache_magic));
+    h.version = cache_version;
+    h.format = format;
+    h.width = image.width();
+    h.height = image.height();
+    h.bytes_per_line = image.bytesPerLine();
+    h.colors = colors.size();
+    h.source_size = source.size;
+    h.source_mtime = source.mtime;
+    memcpy(h.source_hash, source.hash.constData(), sizeof(h.source_hash));
+    const qint64 used = sizeof(h) + h.colors * sizeof(QRgb);
+    h.data_offset = (used + page_size - 1) / page_size * page_size;
+
+    // readers never see a half written file
+    QSaveFile file(name);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write map cache" << name << ":" << file.errorString();
+        return false;
+    }
+    bool ok = file.write(reinterpret_cast<const char*>(&h), sizeof(h)) == sizeof(h);
+    if (h.colors)
+        ok = ok && file.write(reinterpret_cast<const char*>(colors.data()), h.colors * sizeof(QRgb)) == (qint64)(h.colors * sizeof(QRgb));
+    ok = ok && file.write(QByteArray(h.data_offset - used, 0)) == h.data_offset - used;
+    for (int y = 0; ok && y < h.height; y++)
+        ok = file.write(reinterpret_cast<const char*>(image.constScanLine(y)), h.bytes_per_line) == h.bytes_per_line;
+    if (!ok || !file.commit()) {
+        qWarning() << "Can't write map cache" << name << ":" << file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <memory>
+
+class QFileDevice;
+
+/*
+ * Decoded maps, kept in ~/.xglobe/cache so that the next start doesn't
+ * have to decode the image file again. A cache file holds a header with
+ * the size and format of the image and the size and mtime of the file it
+ * was decoded from, the color table, and the pixel rows exactly as QImage
+ * stores them, starting on a page boundary.
+ *
+ * load() maps the file read-only and hands the pages to QImage without a
+ * copy, so they are shared between all xglobe processes and only read
+ * from disk where the globe needs them. Writing to such an image makes a
+ * private copy, as for any QImage on foreign data; the same goes for
+ * setting the color table of an 8 bit map.
+ *
+ * Images derived from a map, like the filtered cloud map, are kept the
+ * same way next to it, one per variant. They are checked against a hash
+ * of the file content instead of its mtime, so a download that replaces
+ * the file by an identical one still finds them.
+ *
+ * TileStore keeps its tiles in the same directory. Files that haven't
+ * been used for a while are removed by prune(), the whole directory can
+ * be deleted at any time, it is filled again as the maps are loaded.
+ */
+class MapCache {
+public:
+    static void setEnabled(bool on);
+    static bool isEnabled();
+
+    /* the cached decode of the image file path, nullptr if there's none
+     * or the file changed since */
+    static std::shared_ptr<QImage> load(const QString& path);
+    static bool store(const QString& path, const QImage& image);
+
+    /* the image file as derived images are checked against, read once
+     * and decoded from data, so that the file can't change in between */
+    struct Content {
+        QByteArray data;
+        QByteArray hash;
+    };
+    static Content readContent(const QString& path);
+
+    /* variant names the processing and has to change with it */
+    static std::shared_ptr<QImage> loadDerived(const QString& path, const Content& content,
+        const QString& variant);
+    static bool storeDerived(const QString& path, const Content& content, const QString& variant,
+        const QImage& image);
+
+    /* where data derived from the image file path is kept */
+    static QString cacheFile(const QString& path, const char* suffix = ".map");
+    /* a cache file was read, prune() keeps it for another max_age_days */
+    static void markUsed(QFileDevice& file);
+    /* removes the cache files nobody used for max_age_days */
+    static void prune(int max_age_days = 30);
+
+private:
+    static QString cacheDir();
+    struct Source;
+    static std::shared_ptr<QImage> read(const QString& name, const Source& source);
+    static bool write(const QString& name, const Source& source, const QImage& image);
+
+    static bool enabled;
+};
@@ -190,7 +190,7 @@ bool MarkerList::appendMarkerFile(const QString& filename)
 }
 
 MarkerList::MarkerList()
-    : markerpixmap(new QPixmap(marker_xpm))
+    : dotimage(marker_xpm)
 {
 }
 
@@ -382,7 +382,7 @@ void MarkerList::paintMarker(QImage& img, const TLocation& l)
     int wx, wy;
 
     QRect br = l->boundingRect(*fm);
-    QPixmap pm(6 + br.width(), 4 + br.height());
+    QImage pm(6 + br.width(), 4 + br.height(), QImage::Format_RGB32);
 
     p.begin(&pm);
     p.setFont(*renderFont);
@@ -401,28 +401,25 @@ void MarkerList::paintMarker(QImage& img, const TLocation& l)
     p.drawText(wx + 1, wy + 1, l->getName());
     p.end();
 
-    QImage labelimage = pm.toImage();
-
-    render_monochrome(l->getColor().rgb(), img, labelimage,
+    render_monochrome(l->getColor().rgb(), img, pm,
         l->x - markerimage.width() / 2 + l->offset_x,
         l->y - markerimage.height() / 2 - pm.height() / 2 + l->offset_y);
 }
 
 void MarkerList::paintDot(QImage& img, const TLocation& l)
 {
-    QPixmap pm(markerpixmap->width(), markerpixmap->height());
+    QImage pm(dotimage.width(), dotimage.height(), QImage::Format_RGB32);
     QPainter p;
     p.begin(&pm);
     p.fillRect(0, 0, pm.width(), pm.height(), Qt::black);
     p.setPen(Qt::white);
-    p.drawPixmap(0, 0, *markerpixmap);
+    p.drawImage(0, 0, dotimage);
     p.end();
 
-    QImage labelimage = pm.toImage();
     render_monochrome(l->getColor().rgb(),
-        img, labelimage,
-        l->x - markerpixmap->width() / 2,
-        l->y - markerpixmap->height() / 2);
+        img, pm,
+        l->x - dotimage.width() / 2,
+        l->y - dotimage.height() / 2);
 }
 
 void MarkerList::paintArrow(QImage& img, const TLocation& l)
@@ -464,7 +461,7 @@ void MarkerList::paintArrow(QImage& img, const TLocation& l)
         y2 = 0;
     }
 
-    QPixmap pm(wx, wy);
+    QImage pm(wx, wy, QImage::Format_RGB32);
     QPainter p;
     p.begin(&pm);
     p.fillRect(0, 0, wx, wy, Qt::black);
@@ -472,7 +469,6 @@ void MarkerList::paintArrow(QImage& img, const TLocation& l)
     p.drawLine(x1, y1, x2, y2);
     p.end();
 
-    QImage labelimage = pm.toImage();
     render_monochrome(l->getColor().rgb(),
-        img, labelimage, l->x + dx, l->y + dy);
+        img, pm, l->x + dx, l->y + dy);
 }
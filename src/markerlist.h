@@ -40,7 +40,6 @@
 
 #include <QImage>
 #include <QColor>
-#include <QPixmap>
 #include <QFont>
 #include <QFontMetrics>
 #include <QList>
@@ -107,7 +106,7 @@ private:
     void render_monochrome(QRgb, QImage&, QImage&, int x, int y);
     void solve_conflicts(std::vector<TLocation>&, int num);
     QImage markerimage;
-    std::unique_ptr<QPixmap> markerpixmap;
+    QImage dotimage; // of paintDot()
     std::unique_ptr<QFont> renderFont;
     std::unique_ptr<QFontMetrics> fm;
     Gen gen;
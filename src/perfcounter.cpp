@@ -0,0 +1,99 @@
+#include "perfcounter.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+PerfCounter::PerfCounter(Event event)
+    : fd(-1)
+{
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    switch (event) {
+    case Event::instructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case Event::l1d_read_misses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case Event::ll_read_misses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    }
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)event;
+#endif
+}
+
+PerfCounter::~PerfCounter()
+{
+#ifdef __linux__
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+bool PerfCounter::isValid() const
+{
+    return fd >= 0;
+}
+
+void PerfCounter::start()
+{
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+void PerfCounter::stop()
+{
+#ifdef __linux__
+    if (fd >= 0)
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+long long PerfCounter::value() const
+{
+    long long count = 0;
+#ifdef __linux__
+    if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count))
+        count = 0;
+#endif
+    return count;
+}
+
+const char* PerfCounter::name(Event event)
+{
+    switch (event) {
+    case Event::instructions:
+        return "instructions";
+    case Event::l1d_read_misses:
+        return "L1D read misses";
+    case Event::ll_read_misses:
+        return "LLC read misses";
+    }
+    return "";
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+ * Hardware event counter of the calling thread and every thread it starts
+ * afterwards (perf_event_open(2), Linux only). Counts of other threads
+ * are added once they have exited. Elsewhere, or when the kernel doesn't
+ * allow it (see /proc/sys/kernel/perf_event_paranoid), isValid() is
+ * false and value() stays 0.
+ */
+class PerfCounter {
+public:
+    enum class Event { instructions, l1d_read_misses, ll_read_misses };
+
+    explicit PerfCounter(Event event);
+    ~PerfCounter();
+
+    bool isValid() const;
+    void start();
+    void stop();
+    long long value() const;
+
+    static const char* name(Event event);
+
+private:
+    int fd;
+
+    // don't want to bother with copy
+    PerfCounter(const PerfCounter&) = delete;
+    PerfCounter& operator=(const PerfCounter&) = delete;
+};
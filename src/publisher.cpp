@@ -0,0 +1,201 @@
+#include "publisher.h"
+#include "imageencoder.h"
+#include "rootpixmap.h"
+#include "workpool.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMetaObject>
+#include <QtDBus/QtDBus>
+#include <cstdio>
+
+Publisher::Publisher(Target t, const QString& name, ImageEncoder& e, RootPixmap* r, QObject* parent)
+    : QObject(parent)
+    , target(t)
+    , file(name)
+    , staging(name + ".next")
+    , encoder(e)
+    , root(r)
+    , busy(false)
+    , queued_ms(0)
+{
+    connect(&process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+        this, &Publisher::commandFinished);
+    connect(&process, &QProcess::errorOccurred, this, &Publisher::commandFailed);
+
+    // like QProcess::waitForFinished() used to
+    timeout.setSingleShot(true);
+    timeout.setInterval(30000);
+    connect(&timeout, &QTimer::timeout, this, &Publisher::commandTimeout);
+}
+
+Publisher::~Publisher()
+{
+    if (thread.joinable())
+        thread.join();
+    if (process.state() != QProcess::NotRunning) {
+        process.kill();
+        process.waitForFinished();
+    }
+    QFile::remove(staging);
+}
+
+void Publisher::setCommand(const QString& p, const QStringList& args)
+{
+    program = p;
+    arguments = args;
+}
+
+bool Publisher::isBusy() const
+{
+    return busy || waiting;
+}
+
+void Publisher::publish(std::shared_ptr<const QImage> const& frame)
+{
+    if (waiting)
+        qDebug() << "Desktop is still busy, dropping a frame";
+    waiting = frame;
+    waiting_since.start();
+    if (!busy)
+        startNext();
+}
+
+void Publisher::startNext()
+{
+    if (thread.joinable())
+        thread.join();
+
+    std::shared_ptr<const QImage> frame = waiting;
+    waiting.reset();
+    queued_ms = waiting_since.elapsed();
+    publishing_since.start();
+    busy = true;
+    const bool staged = (frame == ready);
+    ready.reset();
+
+    thread = std::thread([this, frame, staged] {
+        const bool on_root = root && root->set(*frame);
+        bool ok = on_root;
+        // replaces the file in one step, like QSaveFile does
+        if (!ok && staged)
+            ok = std::rename(QFile::encodeName(staging).constData(), QFile::encodeName(file).constData()) == 0;
+        if (!ok)
+            ok = encoder.save(*frame, file);
+        QMetaObject::invokeMethod(this, "written", Qt::QueuedConnection,
+            Q_ARG(bool, ok), Q_ARG(bool, on_root));
+    });
+}
+
+void Publisher::prepare(std::shared_ptr<const QImage> const& frame)
+{
+    if (busy || waiting || root)
+        return;
+    if (thread.joinable())
+        thread.join();
+
+    preparing = frame;
+    busy = true;
+    thread = std::thread([this, frame] {
+        WorkPool::idleThisThread();
+        const bool ok = encoder.save(*frame, staging);
+        QMetaObject::invokeMethod(this, "prepared", Qt::QueuedConnection, Q_ARG(bool, ok));
+    });
+}
+
+void Publisher::prepared(bool ok)
+{
+    busy = false;
+    if (ok)
+        ready = preparing;
+    preparing.reset();
+    if (waiting)
+        startNext();
+}
+
+void Publisher::written(bool ok, bool on_root)
+{
+    if (!ok || on_root) {
+        finish(ok);
+        return;
+    }
+
+    if (target == Target::plasma) {
+        tellPlasma();
+        return;
+    }
+
+    qDebug() << "QProcess: " << program << arguments;
+    timeout.start();
+    process.start(program, arguments);
+}
+
+void Publisher::commandFinished(int code, QProcess::ExitStatus status)
+{
+    timeout.stop();
+    if (status != QProcess::NormalExit || code != 0)
+        qCritical() << "failed to execute" << program << ": exit code" << code;
+    finish(status == QProcess::NormalExit && code == 0);
+}
+
+void Publisher::commandFailed(QProcess::ProcessError error)
+{
+    // crashes and timeouts end up in commandFinished() as well
+    if (error != QProcess::FailedToStart)
+        return;
+    timeout.stop();
+    qCritical() << "failed to execute" << program << ":" << process.errorString();
+    finish(false);
+}
+
+void Publisher::commandTimeout()
+{
+    qCritical() << "failed to execute" << program << ": timed out";
+    process.kill();
+}
+
+void Publisher::tellPlasma()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    if (!bus.isConnected()) {
+        qCritical() << "Cannot connect to the D-Bus session bus.";
+        finish(false);
+        return;
+    }
+
+    // NOTE: KDE 5 API is still changing, it may not work on all KDE versions
+    QString script;
+    script += "var allDesktops=desktops();";
+    script += "for(var i=0;i<allDesktops.length;i++){";
+    script += "  var d=allDesktops[i];";
+    script += "  d.wallpaperPlugin=\"org.kde.image\";";
+    script += "  d.currentConfigGroup=Array(\"Wallpaper\",\"org.kde.image\",\"General\");";
+    script += "  d.writeConfig(\"Image\",\"file://";
+    script += file;
+    script += "\");";
+    script += "}";
+
+    QDBusMessage call = QDBusMessage::createMethodCall("org.kde.plasmashell", "/PlasmaShell",
+        "org.kde.PlasmaShell", "evaluateScript");
+    call << script;
+    auto watcher = new QDBusPendingCallWatcher(bus.asyncCall(call), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, &Publisher::callFinished);
+}
+
+void Publisher::callFinished(QDBusPendingCallWatcher* call)
+{
+    call->deleteLater();
+    if (call->isError())
+        qCritical() << "Plasma didn't take the wallpaper:" << call->error().message();
+    finish(!call->isError());
+}
+
+void Publisher::finish(bool ok)
+{
+    qDebug() << "Published in" << publishing_since.elapsed() << "ms, after waiting"
+             << queued_ms << "ms";
+    busy = false;
+    emit published(ok);
+    if (waiting)
+        startNext();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QObject>
+#include <QProcess>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <memory>
+#include <thread>
+
+class ImageEncoder;
+class RootPixmap;
+class QDBusPendingCallWatcher;
+
+/*
+ * Hands the rendered frames to the desktop without holding up the render
+ * loop. A frame is written on a background thread, into the root window
+ * or the image file, then the wallpaper setter is told about the file:
+ * xwallpaper is started, or Plasma is sent a script over DBus, and
+ * neither is waited for.
+ *
+ * Only one frame is on its way at a time and one more waits. A newer frame
+ * replaces the waiting one, so a slow desktop gets fewer frames instead
+ * of a backlog. How long publishing takes is logged apart from the
+ * rendering.
+ *
+ * prepare() writes a frame ahead of time, at idle priority, to a file
+ * next to the real one. Publishing that frame later only renames it.
+ *
+ * Needs an event loop, create it on the GUI thread.
+ */
+class Publisher : public QObject {
+    Q_OBJECT
+
+public:
+    enum class Target { command, plasma };
+
+    /* encoder and root aren't used by anyone else meanwhile, root may be nullptr */
+    Publisher(Target target, const QString& file, ImageEncoder& encoder, RootPixmap* root,
+        QObject* parent = nullptr);
+    ~Publisher();
+
+    /* the program that sets the wallpaper from file, for Target::command */
+    void setCommand(const QString& program, const QStringList& arguments);
+    void publish(std::shared_ptr<const QImage> const& frame);
+    /* does nothing while publishing, or when the frames go to the root window */
+    void prepare(std::shared_ptr<const QImage> const& frame);
+    bool isBusy() const;
+
+signals:
+    /* a frame has reached the desktop, or failed to */
+    void published(bool ok);
+
+private slots:
+    void written(bool ok, bool on_root);
+    void prepared(bool ok);
+    void commandFinished(int code, QProcess::ExitStatus status);
+    void commandFailed(QProcess::ProcessError error);
+    void commandTimeout();
+    void callFinished(QDBusPendingCallWatcher* call);
+
+private:
+    void startNext();
+    void tellPlasma();
+    void finish(bool ok);
+
+    const Target target;
+    const QString file;
+    const QString staging; // of prepare()
+    ImageEncoder& encoder;
+    RootPixmap* root;
+    QString program;
+    QStringList arguments;
+    QProcess process;
+    QTimer timeout; // of the command
+
+    std::thread thread;
+    bool busy; // a frame is being published
+    std::shared_ptr<const QImage> waiting; // the next one
+    std::shared_ptr<const QImage> preparing; // being written to staging
+    std::shared_ptr<const QImage> ready; // is in staging
+    QElapsedTimer waiting_since;
+    QElapsedTimer publishing_since;
+    qint64 queued_ms; // the frame being published waited this long
+};
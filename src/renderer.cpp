@@ -69,23 +69,31 @@
 #include "renderer.h"
 #include "compute.h"
 #include "file.h"
+#include "inpaint.h"
+#include "mapcache.h"
+#include "perfcounter.h"
 #include "sunpos.h"
 #include <math.h>
-#include <QApplication>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QPainter>
 #include <QDebug>
 #include <QRgba64>
-#include <QPixmap>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <vector>
+
 Renderer::Renderer(const QSize& size, const QString& mapfile)
+    : frames(size, QImage::Format_RGB32)
 {
-    renderedImage = std::make_shared<QImage>(size, QImage::Format_RGB32);
-    map = loadImage(mapfile);
-
-     qDebug() << "Map size: " << map->width() << "x" << map->height();
+    renderedImage = &frames.begin(false);
+    map_limit = 0;
+    night_tint = false;
+    this->tex_layout = TexLayout::linear;
 
     this->radius = 1000.;
     this->view_long = 0.;
@@ -94,6 +102,7 @@ Renderer::Renderer(const QSize& size, const QString& mapfile)
     this->sun_lat = 0.;
     this->fov = 0.5 * M_PI / 180.;
     this->zoom = 0.9;
+    this->radius_proj = 0;
     this->ambientRed = 0.15;
     this->ambientGreen = 0.15;
     this->ambientBlue = 0.15;
@@ -104,31 +113,82 @@ Renderer::Renderer(const QSize& size, const QString& mapfile)
     stars = nullptr;
     this->trans = 0.0;
     this->rot = 0.0;
+    this->num_threads = WorkPool::defaultThreads();
+    this->kernel = sphereKernel(KernelType::automatic);
+    this->last_key = {};
+    this->sun_relative = false;
+    this->surface_long = 0.;
+    this->lon_offset = 0.;
+    this->incremental = false;
+    this->idle_priority = false;
+    this->full_redraw = true;
+    this->refreshed_pixels = 0;
+    this->shade_area = 0.;
+    this->mip_mode = MipMode::level;
+    selectPipeline();
 
     calcDistance();
+
+    if (!mapfile.isEmpty()) {
+        MapFiles files;
+        files.day = mapfile;
+        loadMaps(files);
+    }
 }
 
 std::shared_ptr<QImage> Renderer::loadImage(const QString& name)
 {
+    const QString path = FileChange::findXglobeFile(name);
+    if (auto cached = MapCache::load(path))
+        return cached;
+
     auto image = std::make_shared<QImage>();
 
-    if (!image->load(FileChange::findXglobeFile(name))) {
+    if (!image->load(path)) {
         return nullptr;
     }
 
     if (image->depth() < 8)
         *image = image->convertToFormat(QImage::Format_Indexed8);
 
+    MapCache::store(path, *image);
     return image;
 }
 
-int Renderer::loadNightMap(const QString& nmapfile)
+/*
+ * Maps that would take more than TileStore::memoryCap() are paged
+ * @return nullptr to load the whole image instead
+ */
+std::shared_ptr<TileStore> Renderer::openTiles(const QString& name)
+{
+    const QString path = FileChange::findXglobeFile(name);
+    if (!TileStore::wantsPaging(path))
+        return nullptr;
+    return TileStore::open(path);
+}
+
+Renderer::MapData Renderer::readMap(const QString& name)
 {
-    if (!mapnight) // we already have a night map!
-        return 1;
+    MapData m;
+    m.tiles = openTiles(name);
+    if (!m.tiles)
+        m.image = loadImage(name);
+    return m;
+}
 
-    mapnight = loadImage(nmapfile);
+Texture Renderer::mapTexture(std::shared_ptr<QImage> const& image,
+    std::shared_ptr<TileStore> const& tiles) const
+{
+    if (tiles)
+        return Texture(tiles, tex_layout);
+    return Texture(image, tex_layout);
+}
 
+int Renderer::loadNightMap(const QString& nmapfile)
+{
+    MapFiles files;
+    files.night = nmapfile;
+    loadMaps(files);
     return 1;
 }
 
@@ -139,86 +199,106 @@ static inline bool bad_color(int r, int g, int b)
 
 int Renderer::loadCloudMap(const QString& cmapfile, int cf)
 {
-    if (!track_clouds) {
-        /* create scale array, atan looks fine to sharpen clouds */
-        for (int i = 0; i < 255; i++) {
-            int j = atan((i - cf) / 20.0) * 290 / M_PI + 125;
-            if (j < 0)
-                v[i] = 0;
-            else if (j > 255)
-                v[i] = 255;
-            else
-                v[i] = j;
-        }
-        track_clouds = std::make_unique<FileChange>(FileChange::findXglobeFile(cmapfile));
+    MapFiles files;
+    files.cloud = cmapfile;
+    files.cloud_filter = cf;
+    loadMaps(files);
+    return 1;
+}
+
+/*
+ * Load the cloud map file, clean it up and scale it to the globe. The
+ * cleaned up map only depends on the file and the filter value, the map
+ * cache keeps it for the next start.
+ * Doesn't touch the renderer, CloudLoader calls it on its own thread.
+ */
+std::shared_ptr<QImage> Renderer::cloudImage(const QString& path, WorkPool& workers) const
+{
+    const QString variant = QString("clouds%1").arg(cloud_filter);
+    // hashed and decoded from the same read, a download replacing the
+    // file meanwhile can't end up cached under the wrong content
+    const QString file = FileChange::findXglobeFile(path);
+    const MapCache::Content content = MapCache::readContent(file);
+    auto image = MapCache::loadDerived(file, content, variant);
+    if (!image) {
+        image = std::make_shared<QImage>(QImage::fromData(content.data));
+        if (image->isNull())
+            return nullptr;
+        filterCloudMap(*image, workers);
+        image = grayImage(image);
+        MapCache::storeDerived(file, content, variant, *image);
     }
+    return grayImage(fitImage(image));
+}
 
-    if (!track_clouds->reload())
-        return 1;
-    if (mapcloud)
-        mapcloud.reset();
-    mapcloud = loadImage(track_clouds->name());
-    if (!mapcloud) {
-        ::exit(21);
+/*
+ * After filterCloudMap() the clouds are shades of gray, a byte per texel
+ * is enough.
+ */
+std::shared_ptr<QImage> Renderer::grayImage(std::shared_ptr<QImage> const& image)
+{
+    if (image->format() == QImage::Format_Grayscale8)
+        return image;
+    return std::make_shared<QImage>(image->convertToFormat(QImage::Format_Grayscale8));
+}
+
+/*
+ * Night maps mostly show city lights of about one color. Keep the
+ * brightest channel of every texel and a color table ramping up to the
+ * average color of the lights, which Texture samples as gray8.
+ */
+std::shared_ptr<QImage> Renderer::tintImage(std::shared_ptr<QImage> const& image)
+{
+    const QImage rgb = image->convertToFormat(QImage::Format_RGB32);
+    auto gray = std::make_shared<QImage>(rgb.size(), QImage::Format_Indexed8);
+    double sum_r = 0., sum_g = 0., sum_b = 0., sum_v = 0.;
+
+    for (int y = 0; y < rgb.height(); y++) {
+        const QRgb* p = reinterpret_cast<const QRgb*>(rgb.constScanLine(y));
+        unsigned char* q = gray->scanLine(y);
+        for (int x = 0; x < rgb.width(); x++) {
+            const int v = std::max(qRed(p[x]), std::max(qGreen(p[x]), qBlue(p[x])));
+            q[x] = v;
+            sum_r += qRed(p[x]);
+            sum_g += qGreen(p[x]);
+            sum_b += qBlue(p[x]);
+            sum_v += v;
+        }
     }
-    int endy = mapcloud->height();
-    int endx = mapcloud->width();
 
-    if (mapcloud->depth() == 8)
-        *mapcloud = mapcloud->convertToFormat(QImage::Format_RGB32);
+    QRgb tint = qRgb(255, 255, 255);
+    if (sum_v > 0.)
+        tint = qRgb(255 * sum_r / sum_v, 255 * sum_g / sum_v, 255 * sum_b / sum_v);
+    QVector<QRgb> colors;
+    for (int i = 0; i < 256; i++)
+        colors.append(Texture::rampColor(tint, i));
+    gray->setColorTable(colors);
+    qDebug() << "Night map tint:" << qRed(tint) << qGreen(tint) << qBlue(tint);
+    return gray;
+}
+
+void Renderer::filterCloudMap(QImage& image, WorkPool& workers) const
+{
+    int endy = image.height();
+    int endx = image.width();
+
+    if (image.depth() != 32)
+        image = image.convertToFormat(QImage::Format_RGB32);
 
     int sb, sg, sr;
     QRgb* p1;
 
-    /* filter out the pink continent outlines */
+    /* fill the pink continent outlines from the closest clouds */
+    std::vector<unsigned char> valid((size_t)endx * endy);
     for (int py = 0; py < endy; py++) {
-        p1 = scan32(*mapcloud, 0, py);
-        for (int px = 0; px < endx; px++) {
-            sr = qRed(*p1);
-            sg = qGreen(*p1);
-            sb = qBlue(*p1);
-
-            if (bad_color(sr, sg, sb)) {
-                int x = px;
-                int y = py;
-                /* use a random walk to grab near data */
-                do {
-                    switch (gen(4)) {
-                    case 0:
-                        if (y < endy - 1) {
-                            y++;
-                            break;
-                        }
-                    case 1:
-                        if (y > 0) {
-                            y--;
-                            break;
-                        }
-                    case 2:
-                        x++;
-                        if (x == endx)
-                            x = 0;
-                        break;
-                    case 3:
-                        x--;
-                        if (x < 0)
-                            x += endx;
-                        break;
-                    }
-                    QRgb* q1 = scan32(*mapcloud, x, y);
-                    sr = qRed(*q1);
-                    sg = qGreen(*q1);
-                    sb = qBlue(*q1);
-                } while (bad_color(sr, sg, sb));
-                *p1 = qRgb(sr, sg, sb);
-            }
-
-            p1++;
-        }
+        p1 = scan32(image, 0, py);
+        for (int px = 0; px < endx; px++, p1++)
+            valid[(size_t)py * endx + px] = !bad_color(qRed(*p1), qGreen(*p1), qBlue(*p1));
     }
+    fillFromNearest(image, valid, workers);
 
     for (int py = 0; py < endy; py++) {
-        p1 = scan32(*mapcloud, 0, py);
+        p1 = scan32(image, 0, py);
         for (int px = 0; px < endx; px++) {
             sb = qBlue(*p1);
             sg = qGreen(*p1);
@@ -227,27 +307,225 @@ int Renderer::loadCloudMap(const QString& cmapfile, int cf)
             p1++;
         }
     }
-    return 1;
 }
 
-void Renderer::loadBackImage(const QString& imagefile, bool tld)
+/*
+ * A screen pixel at the center of the globe covers 1 / radius_proj
+ * radians, a map more than about 2 pi radius_proj texels wide has detail
+ * that never shows up. Scale it down once instead of keeping it for the
+ * mip levels to average away. A bit of margin avoids blurring maps that
+ * are just a little larger.
+ * @return image itself if it isn't too large
+ */
+std::shared_ptr<QImage> Renderer::fitImage(std::shared_ptr<QImage> const& image) const
 {
-    if (backImage)
+    if (!image || !map_limit || image->width() <= map_limit * 5 / 4)
+        return image;
+    const int h = std::max((int)((double)map_limit * image->height() / image->width() + 0.5), 1);
+    qDebug() << "Scaling map" << image->width() << "x" << image->height() << "to"
+             << map_limit << "x" << h;
+    return std::make_shared<QImage>(
+        image->scaled(map_limit, h, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+}
+
+/*
+ * Scale the maps to the size of the globe on screen, which only changes
+ * with the zoom, the field of view or the size of the output. The first
+ * time the maps loaded at full size are at hand, afterwards they are
+ * loaded again, as a larger globe needs more of them. That happens in the
+ * background, frames keep using the maps they have until it is done.
+ */
+void Renderer::fitMaps()
+{
+    if (refit.valid() && refit.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        const FittedMaps fitted = refit.get();
+        if (fitted.day)
+            day_tex = Texture(fitted.day, tex_layout);
+        if (fitted.night)
+            night_tex = Texture(fitted.night, tex_layout);
+        full_redraw = true;
+    }
+
+    const int limit = (int)ceil(2 * M_PI * std::max(radius_proj, 1));
+    // another size while a reload runs is taken care of once it is done
+    if (limit == map_limit || refit.valid())
+        return;
+    const bool reload = (map_limit != 0);
+    map_limit = limit;
+
+    if (reload) {
+        // paged maps have their own mip levels, see TileStore
+        const bool day = !day_tex.isNull() && !day_store;
+        const bool night = !night_tex.isNull() && !night_store;
+        refit = std::async(std::launch::async, [this, day, night] {
+            FittedMaps fitted;
+            if (day)
+                fitted.day = fitImage(loadImage(map_file));
+            if (night)
+                fitted.night = fitImage(loadImage(night_file));
+            if (night_tint && fitted.night)
+                fitted.night = tintImage(fitted.night);
+            return fitted;
+        });
+        // the cloud map comes back through take(), see renderFrame()
+        if (cloud_loader)
+            cloud_loader->reload();
         return;
+    }
 
-    backImage = loadImage(imagefile);
-    tiled = tld;
+    // the textures keep what they need of the maps loaded at full size
+    if (map) {
+        day_tex = Texture(fitImage(map), tex_layout);
+        map.reset();
+    }
+    // loaded untinted, see loadMaps()
+    if (mapnight) {
+        auto fitted = fitImage(mapnight);
+        if (night_tint)
+            fitted = tintImage(fitted);
+        night_tex = Texture(fitted, tex_layout);
+        mapnight.reset();
+    }
+    if (mapcloud) {
+        cloud_tex = Texture(grayImage(fitImage(mapcloud)), tex_layout);
+        mapcloud.reset();
+    }
+    full_redraw = true;
+}
+
+void Renderer::loadBackImage(const QString& imagefile, bool tld)
+{
+    MapFiles files;
+    files.back = imagefile;
+    files.tiled_back = tld;
+    loadMaps(files);
+}
+
+/*
+ * The files don't depend on each other, so every one is read on a thread
+ * of its own and the maps are only switched to once all are done. That
+ * takes about as long as the slowest file alone. Layers that are already
+ * loaded are left as they are.
+ */
+void Renderer::loadMaps(const MapFiles& files)
+{
+    QElapsedTimer total;
+    total.start();
+
+    auto start = [](const QString& name, auto read) {
+        return std::async(std::launch::async, [name, read] {
+            QElapsedTimer timer;
+            timer.start();
+            auto result = read();
+            qDebug() << "Loaded" << name << "in" << timer.elapsed() << "ms";
+            return result;
+        });
+    };
+
+    std::future<MapData> day, night;
+    std::future<std::shared_ptr<QImage>> cloud, back;
+
+    if (!files.day.isEmpty() && day_tex.isNull())
+        day = start(files.day, [&files] { return readMap(files.day); });
+
+    if (!files.night.isEmpty() && night_tex.isNull()) {
+        night = start(files.night, [this, &files] {
+            MapData m = readMap(files.night);
+            m.image = fitImage(m.image);
+            // tinted once scaled, by fitMaps() if that is still to come
+            if (map_limit && night_tint && m.image)
+                m.image = tintImage(m.image);
+            return m;
+        });
+    }
+
+    if (!files.cloud.isEmpty() && !cloud_loader) {
+        /* create scale array, atan looks fine to sharpen clouds */
+        const int cf = files.cloud_filter;
+        for (int i = 0; i < 255; i++) {
+            int j = atan((i - cf) / 20.0) * 290 / M_PI + 125;
+            if (j < 0)
+                v[i] = 0;
+            else if (j > 255)
+                v[i] = 255;
+            else
+                v[i] = j;
+        }
+        cloud_file = FileChange::findXglobeFile(files.cloud);
+        cloud_filter = cf;
+        // the other files are read by a single thread each anyway
+        WorkPool& workers = workPool();
+        cloud = start(files.cloud, [this, &workers] { return cloudImage(cloud_file, workers); });
+    }
+
+    if (!files.back.isEmpty() && !backImage) {
+        const QSize screen = renderedImage->size();
+        back = start(files.back, [&files, screen] {
+            auto image = loadImage(files.back);
+            if (!files.tiled_back && image && image->size() != screen) {
+                // stretched over the whole screen, one texel per pixel is enough
+                image = std::make_shared<QImage>(image->scaled(screen,
+                    Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+            }
+            return image;
+        });
+    }
+
+    if (day.valid()) {
+        const MapData m = day.get();
+        map_file = files.day;
+        map = m.image;
+        day_store = m.tiles;
+        day_tex = mapTexture(map, day_store);
+        qDebug() << "Map levels:" << day_tex.levels() << "," << day_tex.memoryUsage() / 1024 << "KiB";
+        qDebug() << "Map size: " << day_tex.width() << "x" << day_tex.height();
+    }
+
+    if (night.valid()) {
+        const MapData m = night.get();
+        night_file = files.night;
+        mapnight = m.image;
+        night_store = m.tiles;
+        night_tex = mapTexture(mapnight, night_store);
+    }
+
+    if (cloud.valid()) {
+        mapcloud = cloud.get();
+        if (!mapcloud) {
+            ::exit(21);
+        }
+        cloud_tex = Texture(mapcloud, tex_layout);
+
+        // later versions of the file are loaded in the background, see
+        // renderFrame()
+        cloud_loader = std::make_unique<CloudLoader>(cloud_file, [this](const QString& path) {
+            WorkPool pool;
+            return cloudImage(path, pool);
+        });
+    }
 
-    if (!tiled && backImage) {
-        QSize smallSize (renderedImage->width(), renderedImage->height());
-        QImage bi = backImage->scaled(smallSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-        backImage.reset();
-        backImage = std::make_shared<QImage>();
+    if (back.valid()) {
+        backImage = back.get();
+        tiled = files.tiled_back;
     }
+
+    // only kept for the first fitMaps()
+    if (map_limit) {
+        map.reset();
+        mapnight.reset();
+        mapcloud.reset();
+    }
+
+    full_redraw = true;
+    qDebug() << "Maps loaded in" << total.elapsed() << "ms";
 }
 
 Renderer::~Renderer()
 {
+    // a decode or reload still running uses the renderer
+    cloud_loader.reset();
+    if (refit.valid())
+        refit.wait();
 }
 
 void Renderer::setViewPos(double lat, double lon)
@@ -303,6 +581,11 @@ double Renderer::getSunLat()
     return sun_lat * 180. / M_PI;
 }
 
+int Renderer::getProjectedRadius()
+{
+    return radius_proj;
+}
+
 double Renderer::getSunLong()
 {
     return sun_long * 180. / M_PI;
@@ -322,6 +605,7 @@ double Renderer::getZoom()
 void Renderer::setMarkerList(TMarkerListPtr const& marker)
 {
     markerlist = marker;
+    full_redraw = true;
 }
 
 void Renderer::showLabel(bool show)
@@ -354,12 +638,13 @@ void Renderer::setLabelPos(int x, int y)
 void Renderer::setShadeArea(double area)
 {
     shade_area = area;
+    full_redraw = true;
 }
 
 void Renderer::setAmbientRGB(QRgba64 const& rgb)
 {
     const int samples = 100;
-    if (mapnight != nullptr) {
+    if (!night_tex.isNull()) {
         // Auto-calibrate ambient rgb by random sampling.
         int dr_tot = 0, dg_tot = 0, db_tot = 0;
         int nr_tot = 0, ng_tot = 0, nb_tot = 0;
@@ -367,11 +652,11 @@ void Renderer::setAmbientRGB(QRgba64 const& rgb)
             double longitude = gen(3600) * M_PI / 1800.0;
             double latitude = gen(1800) * M_PI / 1800.0 - M_PI / 2.0;
             int r, g, b;
-            getMapColorLinear(map, longitude, latitude, &r, &g, &b);
+            getMapColorLinear(day_tex, longitude, latitude, &r, &g, &b);
             dr_tot += r;
             dg_tot += g;
             db_tot += b;
-            getMapColorLinear(mapnight, longitude, latitude, &r, &g, &b);
+            getMapColorLinear(night_tex, longitude, latitude, &r, &g, &b);
             nr_tot += r;
             ng_tot += g;
             nb_tot += b;
@@ -385,6 +670,7 @@ void Renderer::setAmbientRGB(QRgba64 const& rgb)
         ambientGreen = rgb.green();
         ambientBlue = rgb.blue();
     }
+    full_redraw = true;
 }
 
 void Renderer::setFov(double fov)
@@ -407,6 +693,7 @@ time_t Renderer::getTime()
 void Renderer::setNumGridLines(int num)
 {
     d_gridline = M_PI / (2.0 * num);
+    full_redraw = true;
 }
 
 int Renderer::getNumGridLines()
@@ -417,6 +704,7 @@ int Renderer::getNumGridLines()
 void Renderer::setNumGridDots(int num)
 {
     d_griddot = 2.0 * M_PI / num;
+    full_redraw = true;
 }
 
 int Renderer::getNumGridDots()
@@ -427,6 +715,7 @@ int Renderer::getNumGridDots()
 void Renderer::setGridType(GridType type)
 {
     gridtype = type;
+    full_redraw = true;
 }
 
 GridType Renderer::getGridType()
@@ -441,6 +730,7 @@ void Renderer::setTransition(double t)
         trans = 0.9999;
     else if (trans < 0.0)
         trans = 0.0;
+    full_redraw = true;
 }
 
 double Renderer::getTransition()
@@ -448,6 +738,79 @@ double Renderer::getTransition()
     return trans;
 }
 
+void Renderer::setNumThreads(int num)
+{
+    num_threads = (num > 0) ? num : WorkPool::defaultThreads();
+}
+
+int Renderer::getNumThreads()
+{
+    return num_threads;
+}
+
+void Renderer::setIncremental(bool on)
+{
+    incremental = on;
+    full_redraw = true;
+}
+
+void Renderer::setIdlePriority(bool on)
+{
+    idle_priority = on;
+    pool.reset(); // started again by workPool()
+}
+
+size_t Renderer::getRefreshedPixels()
+{
+    return refreshed_pixels;
+}
+
+QRegion Renderer::takeChangedRegion()
+{
+    QRegion region;
+    std::swap(region, changed);
+    return region;
+}
+
+void Renderer::setMipmap(MipMode mode)
+{
+    mip_mode = mode;
+    full_redraw = true;
+}
+
+void Renderer::setNightTint(bool on)
+{
+    night_tint = on;
+}
+
+void Renderer::setTextureLayout(TexLayout layout)
+{
+    if (layout == tex_layout)
+        return;
+    tex_layout = layout;
+    day_tex.setLayout(layout);
+    night_tex.setLayout(layout);
+    cloud_tex.setLayout(layout);
+    full_redraw = true;
+}
+
+void Renderer::setSunRelative(bool follow)
+{
+    sun_relative = follow;
+}
+
+bool Renderer::setKernel(KernelType type)
+{
+    SphereKernel k = sphereKernel(type);
+    if (!k) {
+        qWarning() << "Sphere kernel" << kernelName(type) << "is not supported on this cpu";
+        return false;
+    }
+    kernel = k;
+    qDebug() << "Sphere kernel:" << kernelName(type);
+    return true;
+}
+
 void Renderer::calcDistance()
 {
     double x;
@@ -464,39 +827,23 @@ void Renderer::calcDistance()
 
 void Renderer::renderFrame()
 {
-    double dir_x, dir_y, dir_z; // direction of cast ray
-    double hit_x, hit_y, hit_z; // hit position on earth surface
-    double hit2_x = 0, hit2_y = 0, hit2_z = 0; // mirrored hit position on earth surface
-    double sp_x, sp_y, sp_z; // intersection point of globe and ray
-    double a, b, c; // coeff. of quadratic equation
-    double radikand;
-    double wurzel;
-    double r; // r'
-    double radiusq = radius * radius;
-    double s1, s2, s; // distance between intersections and
-        // camera position
-    double longitude, latitude; // coordinates of hit position
-    double light_angle; // cosine of angle between sunlight and
-        // surface normal
+    double dir_z; // direction of cast ray
+    double b, c; // coeff. of quadratic equation
     int startx, endx; // the region to be painted
     int starty, endy;
-    int real_startx, real_endx;
-    int temp;
 
-    QRgb* p; // pointer to current pixel
-    QRgb* q;
-
-    loadCloudMap(); // reload cloudmap, if changed
-    int half_width = renderedImage->width() / 2 + renderedImage->width() % 2 - 1;
-
-    // clear image
-    for (int i = 0; i < renderedImage->height(); i++) {
-        p = scan32(*renderedImage, 0, i);
-        memset(p, 0, renderedImage->bytesPerLine());
+    // a cloud map decoded since the last frame
+    if (cloud_loader) {
+        if (auto image = cloud_loader->take()) {
+            image = grayImage(fitImage(image));
+            cloud_tex = Texture(image, tex_layout);
+            if (mapcloud)
+                mapcloud = image; // fitMaps() is still to come
+            full_redraw = true;
+        }
     }
-
-    copyBackImage();
-    drawStars();
+    const int width = renderedImage->width();
+    const int height = renderedImage->height();
 
     // rotation matrix
     RotMatrix mat(rot, view_long, view_lat);
@@ -504,104 +851,160 @@ void Renderer::renderFrame()
     dir_z = -proj_dist;
 
     // indifferent coeff.
-    c = center_dist * center_dist - radiusq;
+    c = center_dist * center_dist - radius * radius;
 
     // calc. radius of projected sphere
     b = 2 * center_dist * dir_z;
     radius_proj = (int)sqrt(b * b / (4 * c) - dir_z * dir_z);
-
-    startx = (renderedImage->width() / 2 - radius_proj - 1);
+    fitMaps();
+
+    // mip levels with about one texel per screen pixel
+    const int day_level = day_tex.level();
+    day_tex.selectLevel(radius_proj, mip_mode);
+    night_tex.selectLevel(radius_proj, mip_mode);
+    cloud_tex.selectLevel(radius_proj, mip_mode);
+    if (day_tex.level() != day_level)
+        qDebug() << "Map level" << day_tex.level() << ":" << day_tex.width() << "x" << day_tex.height();
+    selectPipeline();
+
+    SphereSetup setup;
+    mat.elements(setup.m);
+    setup.dir_z = dir_z;
+    setup.b = b;
+    setup.c = c;
+    setup.center_dist = center_dist;
+    setup.inv_radius = 1. / radius;
+
+    startx = (width / 2 - radius_proj - 1);
     startx = (startx < 0) ? 0 : startx;
-    endx = renderedImage->width() - startx - 1;
-    starty = (renderedImage->height() / 2 - radius_proj - 1);
+    endx = width - startx - 1;
+    starty = (height / 2 - radius_proj - 1);
     starty = (starty < 0) ? 0 : starty;
-    endy = renderedImage->height() - starty - 1;
-
-    for (int py = starty; py <= endy; py++) {
-        // handle any paint events waiting in the queue
-        qApp->processEvents();
-
-        temp = radius_proj * radius_proj - (py - renderedImage->height() / 2) * (py - renderedImage->height() / 2);
-
-        if (temp >= 0)
-            startx = (renderedImage->width() / 2 - (int)sqrt(temp));
+    endy = height - starty - 1;
+
+    // with the same view as last time the traced positions can be reused,
+    // keep them once a view has been used twice in a row
+    SurfaceKey key = { view_lat, view_long, rot, center_dist, proj_dist,
+        shift_x, shift_y, width, height };
+    if (sun_relative) {
+        // the view follows the sun: the globe only turns under the camera,
+        // light and latitude of every pixel stay the same and the
+        // longitude moves by the same amount everywhere. The sun's
+        // declination drifts slowly, ignore that up to a quarter pixel.
+        key.view_long = 0.;
+        if (fabs(view_lat - last_key.view_lat) < 0.25 / std::max(radius_proj, 1))
+            key.view_lat = last_key.view_lat;
+    }
+    // the light angles cached with the view following the sun were
+    // computed with the old -transition, trace and store them again
+    if (sun_relative && full_redraw)
+        surface.clear();
+    SurfacePass pass = SurfacePass::trace;
+    if (surface.isValid(key)) {
+        // at a fixed view only pixels near the terminator change, drawn
+        // over a copy of the previous frame. Not with markers or a grid,
+        // drawing them again over the old ones would darken their
+        // blended edges and leave labels behind that moved.
+        const bool overlay = markerlist || gridtype != GridType::no;
+        if (incremental && !sun_relative && !full_redraw && !overlay && surface.hasLight())
+            pass = SurfacePass::update;
         else
-            startx = (renderedImage->width() / 2);
-
-        startx = (startx < 0) ? 0 : startx;
-        endx = renderedImage->width() - startx - 1;
+            pass = SurfacePass::cached;
+    }
+    else if (key == last_key) {
+        std::vector<SurfaceCache::Row> rows(endy - starty + 1);
+        for (int py = starty; py <= endy; py++) {
+            SurfaceCache::Row& row = rows[py - starty];
+            if (!rowSpan(py, row.startx, row.endx))
+                row = { 0, -1 };
+        }
+        surface.prepare(key, starty, rows, sun_relative || incremental);
+        surface_long = view_long;
+        pass = SurfacePass::store;
+        qDebug() << "Surface cache:" << surface.memoryUsage() / 1024 << "KiB";
+    }
+    else {
+        surface.clear();
+    }
+    last_key = key;
+    lon_offset = sun_relative ? view_long - surface_long : 0.;
+    if (day_tex.isVirtual() || night_tex.isVirtual())
+        pageTextures(setup, starty, endy);
+
+    // a buffer nobody has borrowed, the incremental update starts from
+    // the last frame
+    renderedImage = &frames.begin(pass == SurfacePass::update);
+
+    if (pass != SurfacePass::update) {
+        // clear image
+        for (int i = 0; i < height; i++)
+            memset(scan32(*renderedImage, 0, i), 0, renderedImage->bytesPerLine());
+
+        copyBackImage();
+        drawStars();
+        full_redraw = false;
+    }
 
-        // calculate offset into image data
-        if (py + shift_y < 0 || py + shift_y >= renderedImage->height())
+    // split the globe into tiles, drop those which can't show up on screen
+    std::vector<Tile> tiles;
+    const int reach = (radius_proj + 1) * (radius_proj + 1);
+    for (int y0 = starty; y0 <= endy; y0 += tile_size) {
+        const int y1 = std::min(y0 + tile_size - 1, endy);
+        if (y1 + shift_y < 0 || y0 + shift_y >= height)
             continue;
-        real_startx = startx + shift_x;
-        real_startx = (real_startx < 0 ? 0 : real_startx);
-        real_startx = (real_startx >= renderedImage->width() ? renderedImage->width() - 1 : real_startx);
-
-        real_endx = endx + shift_x;
-        real_endx = (real_endx < 0 ? 0 : real_endx);
-        real_endx = (real_endx >= renderedImage->width() ? renderedImage->width() - 1 : real_endx);
-
-        p = scan32(*renderedImage, real_startx, py + shift_y);
-        q = scan32(*renderedImage, real_endx, py + shift_y);
-
-        if (rot == 0.) // optimization when using no rotation
-            endx = half_width;
-
-        for (int px = startx; px <= endx; px++) {
-            dir_x = (px - renderedImage->width() / 2);
-            dir_y = (-py + renderedImage->height() / 2);
-
-            a = dir_x * dir_x + dir_y * dir_y + dir_z * dir_z;
-            b = 2 * center_dist * dir_z;
-            // c constant, see above
-
-            radikand = b * b - 4 * a * c; // what's under the sq.root when solving the
-                // quadratic equation
-            if (radikand >= 0.) // solution exists <=> intersection
-            {
-                wurzel = sqrt(radikand);
-                s1 = (-b + wurzel) / (2. * a);
-                s2 = (-b - wurzel) / (2. * a);
-                s = (s1 < s2) ? s1 : s2; // smaller solution belongs to nearer
-                    // intersection
-                sp_x = s * dir_x; // sp = camera pos + s*dir
-                sp_y = s * dir_y;
-                sp_z = center_dist + s * dir_z;
-
-                mat.transform(sp_x, sp_y, sp_z, hit_x, hit_y, hit_z);
-
-                if (rot == 0.) // optimization when using no rotation
-                    mat.transform(-sp_x, sp_y, sp_z, hit2_x, hit2_y, hit2_z);
-
-                longitude = atan(hit_x / hit_z);
-                if (hit_z < 0.)
-                    longitude = M_PI + longitude;
-
-                r = (double)sqrt(hit_x * hit_x + hit_z * hit_z);
-                latitude = atan(-hit_y / r);
-
-                light_angle = (light_x * hit_x + light_y * hit_y + light_z * hit_z) / radius;
-                light_angle = pow(light_angle, 1.0 - trans);
+        const int dy = std::max(y0 - height / 2, std::min(0, y1 - height / 2));
 
-                // Set pixel in image
-                *p++ = getPixelColor(longitude, latitude, light_angle);
+        for (int x0 = startx; x0 <= endx; x0 += tile_size) {
+            const int x1 = std::min(x0 + tile_size - 1, endx);
+            if (x1 + shift_x < 0 || x0 + shift_x >= width)
+                continue;
+            const int dx = std::max(x0 - width / 2, std::min(0, x1 - width / 2));
+            if (dx * dx + dy * dy > reach)
+                continue;
+            tiles.push_back({ x0, y0, x1, y1 });
+        }
+    }
 
-                // only when using no rotation:
-                // mirror the left half-circle of the globe: we need a new position
-                // and have to recalculate the light intensity
-                if (rot == 0.) {
-                    light_angle = (light_x * hit2_x + light_y * hit2_y + light_z * hit2_z) / radius;
-                    light_angle = pow(light_angle, 1.0 - trans);
-                    *q-- = getPixelColor(2 * view_long - longitude, latitude, light_angle);
-                }
-            }
-            else {
-                p++;
-                q--;
+    std::vector<size_t> refreshed(tiles.size());
+    workPool().run(tiles.size(), [&](size_t i, int) {
+        refreshed[i] = (this->*tile_fn)(tiles[i], setup, pass);
+    });
+
+    if (pass == SurfacePass::store)
+        surface.setValid();
+
+    refreshed_pixels = 0;
+    for (size_t n : refreshed)
+        refreshed_pixels += n;
+    qDebug() << "Refreshed" << refreshed_pixels << "pixels"
+             << (pass == SurfacePass::update ? "(incremental)" : "");
+
+    // an incremental update only touched the tiles it painted in, the
+    // rows of a tile that did are merged into one rectangle
+    const QRect screen(0, 0, width, height);
+    QRegion damage;
+    if (pass == SurfacePass::update) {
+        QRect row;
+        for (size_t i = 0; i < tiles.size(); i++) {
+            if (!refreshed[i])
+                continue;
+            const QRect tile(tiles[i].x0 + shift_x, tiles[i].y0 + shift_y,
+                tiles[i].x1 - tiles[i].x0 + 1, tiles[i].y1 - tiles[i].y0 + 1);
+            if (!row.isNull() && row.top() == tile.top() && row.right() + 1 == tile.left()) {
+                row.setRight(tile.right());
+                continue;
             }
+            if (!row.isNull())
+                damage += row.intersected(screen);
+            row = tile;
         }
+        if (!row.isNull())
+            damage += row.intersected(screen);
     }
+    else {
+        damage = QRegion(screen);
+    }
+    changed += damage;
 
     if (gridtype != GridType::no)
         drawGrid();
@@ -611,6 +1014,294 @@ void Renderer::renderFrame()
 
     //if (show_label)
      ///   drawLabel();
+
+    frames.finish(damage);
+}
+
+bool Renderer::rowSpan(int py, int& startx, int& endx) const
+{
+    const int width = renderedImage->width();
+    const int height = renderedImage->height();
+
+    if (py + shift_y < 0 || py + shift_y >= height)
+        return false;
+
+    const int temp = radius_proj * radius_proj - (py - height / 2) * (py - height / 2);
+
+    if (temp >= 0)
+        startx = (width / 2 - (int)sqrt(temp));
+    else
+        startx = (width / 2);
+
+    startx = (startx < 0) ? 0 : startx;
+    endx = width - startx - 1;
+
+    // clip to the screen
+    startx = std::max(startx, -shift_x);
+    endx = std::min(endx, width - 1 - shift_x);
+    return startx <= endx;
+}
+
+/*
+ * Page in the tiles of the large maps the frame will sample, found by
+ * tracing every 4th pixel of every 4th row.
+ */
+void Renderer::pageTextures(const SphereSetup& setup, int starty, int endy)
+{
+    const int step = 4;
+    const int width = renderedImage->width();
+    const int height = renderedImage->height();
+
+    float lon[span_padding];
+    float lat[span_padding];
+    float nx[span_padding];
+    float ny[span_padding];
+    float nz[span_padding];
+    unsigned char hit[span_padding];
+    const SurfaceSpan traced = { lon, lat, nx, ny, nz, hit };
+
+    for (int py = starty; py <= endy + step - 1; py += step) {
+        int startx, endx;
+        if (!rowSpan(std::min(py, endy), startx, endx))
+            continue;
+        for (int px = startx; px <= endx + step - 1; px += step) {
+            const int x = std::min(px, endx);
+            kernel(setup, -std::min(py, endy) + height / 2, x - width / 2, 1, traced);
+            if (!hit[0])
+                continue;
+            day_tex.request(lon[0], lat[0]);
+            night_tex.request(lon[0], lat[0]);
+        }
+    }
+    day_tex.pageIn();
+    night_tex.pageIn();
+}
+
+/*
+ * @return how many pixels of the tile were painted
+ */
+template <TexelFormat Day, TexelFormat Night, TexelFormat Cloud>
+size_t Renderer::renderTile(const Tile& tile, const SphereSetup& setup, SurfacePass pass)
+{
+    // hit positions of the current row, see sphere_kernel.h
+    float lon[tile_size + span_padding];
+    float lat[tile_size + span_padding];
+    float nx[tile_size + span_padding];
+    float ny[tile_size + span_padding];
+    float nz[tile_size + span_padding];
+    unsigned char hit[tile_size + span_padding];
+    const SurfaceSpan traced = { lon, lat, nx, ny, nz, hit };
+
+    double light_angle; // cosine of angle between sunlight and
+        // surface normal
+    int startx, endx; // the region of the current row
+    size_t painted = 0;
+
+    const int width = renderedImage->width();
+    const int height = renderedImage->height();
+
+    // towards the limb a pixel covers more of the map, by 1 / cos of the
+    // angle between view and surface; beyond twice that only the next mip
+    // level is used anyway
+    const double inv_r2 = 1. / std::max(radius_proj * radius_proj, 1);
+    auto limbAt = [&](int px, int py) -> float {
+        if (mip_mode != MipMode::blend)
+            return 0.f;
+        const int dx = px - width / 2;
+        const int dy = py - height / 2;
+        const double cos2 = 1. - (dx * dx + dy * dy) * inv_r2;
+        return cos2 > 0.25 ? -0.5 * log2(cos2) : 1.f;
+    };
+
+    for (int py = tile.y0; py <= tile.y1; py++) {
+        if (!rowSpan(py, startx, endx))
+            continue;
+        startx = std::max(startx, tile.x0);
+        endx = std::min(endx, tile.x1);
+        if (startx > endx)
+            continue;
+
+        const int n = endx - startx + 1;
+        SurfaceSpan span = traced;
+        if (pass == SurfacePass::cached || pass == SurfacePass::update) {
+            span = surface.span(py, startx);
+        }
+        else {
+            kernel(setup, -py + height / 2, startx - width / 2, n, traced);
+            if (pass == SurfacePass::store) {
+                const SurfaceSpan stored = surface.span(py, startx);
+                memcpy(stored.lon, traced.lon, n * sizeof(float));
+                memcpy(stored.lat, traced.lat, n * sizeof(float));
+                memcpy(stored.nx, traced.nx, n * sizeof(float));
+                memcpy(stored.ny, traced.ny, n * sizeof(float));
+                memcpy(stored.nz, traced.nz, n * sizeof(float));
+                memcpy(stored.hit, traced.hit, n);
+            }
+        }
+
+        QRgb* p = scan32(*renderedImage, startx + shift_x, py + shift_y);
+
+        if (pass == SurfacePass::cached && sun_relative) {
+            // nothing left to compute but the colors
+            const float* light = surface.light(py, startx);
+            for (int i = 0; i < n; i++) {
+                if (span.hit[i]) {
+                    p[i] = shadePixel<Day, Night, Cloud>(span.lon[i] + lon_offset, span.lat[i], light[i],
+                        limbAt(startx + i, py));
+                    painted++;
+                }
+            }
+            continue;
+        }
+
+        // light angles of the previous frame, see lightClass(), or to be
+        // stored for the view following the sun
+        float* light = nullptr;
+        if (surface.hasLight() && (pass == SurfacePass::store || (pass != SurfacePass::trace && !sun_relative)))
+            light = surface.light(py, startx);
+
+        for (int i = 0; i < n; i++) {
+            if (!span.hit[i])
+                continue;
+
+            light_angle = light_x * span.nx[i] + light_y * span.ny[i] + light_z * span.nz[i];
+            if (trans != 0.)
+                light_angle = pow(light_angle, 1.0 - trans);
+
+            if (pass == SurfacePass::update) {
+                const int now = lightClass(light_angle);
+                const bool same = (now != 1 && now == lightClass(light[i]));
+                light[i] = light_angle;
+                if (same)
+                    continue; // still fully lit or fully dark
+            }
+            else if (light)
+                light[i] = light_angle;
+
+            // Set pixel in image
+            p[i] = shadePixel<Day, Night, Cloud>(span.lon[i], span.lat[i], light_angle,
+                limbAt(startx + i, py));
+            painted++;
+        }
+    }
+    return painted;
+}
+
+/*
+ * Pick the render loop that matches the loaded maps, so that the per
+ * pixel code doesn't have to check for them.
+ */
+void Renderer::selectPipeline()
+{
+    shade_scale = shade_area ? 1. / shade_area : 1.;
+
+    if (cloud_tex.format() == TexelFormat::none)
+        pickNight<TexelFormat::none>();
+    else
+        pickNight<TexelFormat::gray8>(); // see loadCloudMap()
+}
+
+template <TexelFormat Cloud>
+void Renderer::pickNight()
+{
+    switch (night_tex.format()) {
+    case TexelFormat::none:
+        pickDay<TexelFormat::none, Cloud>();
+        break;
+    case TexelFormat::rgb32:
+        pickDay<TexelFormat::rgb32, Cloud>();
+        break;
+    case TexelFormat::indexed8:
+        pickDay<TexelFormat::indexed8, Cloud>();
+        break;
+    case TexelFormat::gray8:
+        pickDay<TexelFormat::gray8, Cloud>();
+        break;
+    }
+}
+
+template <TexelFormat Night, TexelFormat Cloud>
+void Renderer::pickDay()
+{
+    switch (day_tex.format()) {
+    case TexelFormat::indexed8:
+        tile_fn = &Renderer::renderTile<TexelFormat::indexed8, Night, Cloud>;
+        pixel_fn = &Renderer::shadePixel<TexelFormat::indexed8, Night, Cloud>;
+        break;
+    case TexelFormat::gray8:
+        tile_fn = &Renderer::renderTile<TexelFormat::gray8, Night, Cloud>;
+        pixel_fn = &Renderer::shadePixel<TexelFormat::gray8, Night, Cloud>;
+        break;
+    default:
+        tile_fn = &Renderer::renderTile<TexelFormat::rgb32, Night, Cloud>;
+        pixel_fn = &Renderer::shadePixel<TexelFormat::rgb32, Night, Cloud>;
+        break;
+    }
+}
+
+/*
+ * 0: night side, the color does not depend on the light angle
+ * 2: day side, the same
+ * 1: somewhere in between
+ */
+int Renderer::lightClass(double angle) const
+{
+    if (angle > shade_area)
+        return 2;
+    if (angle < (night_tex.isNull() ? 0. : -0.1))
+        return 0;
+    return 1;
+}
+
+/*
+ * Render the current view with either texture layout and print the time
+ * per frame and the cache misses, if the kernel lets us count them.
+ */
+void Renderer::benchmark(int frames)
+{
+    const PerfCounter::Event events[] = { PerfCounter::Event::instructions,
+        PerfCounter::Event::l1d_read_misses, PerfCounter::Event::ll_read_misses };
+    const TexLayout layouts[] = { TexLayout::linear, TexLayout::tiled };
+    const TexLayout saved = tex_layout;
+
+    frames = std::max(frames, 1);
+    for (TexLayout layout : layouts) {
+        setTextureLayout(layout);
+        // fill the surface cache, from now on it's mostly texture lookups
+        renderFrame();
+        renderFrame();
+
+        std::vector<std::unique_ptr<PerfCounter>> counters;
+        for (PerfCounter::Event e : events)
+            counters.push_back(std::make_unique<PerfCounter>(e));
+        // workers started after the counters are counted as well
+        pool.reset();
+        for (auto& c : counters)
+            c->start();
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < frames; i++) {
+            full_redraw = true;
+            renderFrame();
+        }
+        const double ms = timer.nsecsElapsed() / 1e6 / frames;
+        // counts of the workers are added when they exit
+        pool.reset();
+        for (auto& c : counters)
+            c->stop();
+
+        qInfo().nospace() << (layout == TexLayout::tiled ? "tiled" : "linear")
+                          << " texture layout: " << ms << " ms per frame";
+        for (size_t i = 0; i < counters.size(); i++) {
+            if (counters[i]->isValid())
+                qInfo().nospace() << "    " << PerfCounter::name(events[i]) << ": "
+                                  << counters[i]->value() / frames << " per frame";
+            else
+                qInfo().nospace() << "    " << PerfCounter::name(events[i]) << ": not available";
+        }
+    }
+    setTextureLayout(saved);
 }
 
 void Renderer::copyBackImage()
@@ -652,6 +1343,16 @@ void Renderer::copyBackImage()
     }
 }
 
+WorkPool& Renderer::workPool()
+{
+    if (!pool || pool->threads() != num_threads) {
+        pool = std::make_unique<WorkPool>(num_threads);
+        if (idle_priority)
+            pool->setIdlePriority();
+    }
+    return *pool;
+}
+
 void Renderer::calcLightVector()
 {
     SunPos::GetSunPos(time_to_render, &sun_lat, &sun_long);
@@ -661,26 +1362,42 @@ void Renderer::calcLightVector()
     light_z = cos(sun_lat) * cos(sun_long);
 }
 
+template <TexelFormat F>
+static inline void mapColor(const Texture& t, double longitude, double latitude,
+    float limb, int* r, int* g, int* b)
+{
+    const QRgb c = t.sample<F>(longitude, latitude, limb);
+    *r = qRed(c);
+    *g = qGreen(c);
+    *b = qBlue(c);
+}
+
 unsigned int Renderer::getPixelColor(double longitude, double latitude,
     double angle)
 {
-    int r, g, b;
-    double shade_angle;
+    return (this->*pixel_fn)(longitude, latitude, angle, 0.f);
+}
 
-    if (shade_area)
-        shade_angle = angle / shade_area;
-    else
-        shade_angle = 1.0;
+/*
+ * Color of one globe pixel. Which maps are there and how they are stored
+ * is fixed at compile time, see selectPipeline().
+ */
+template <TexelFormat Day, TexelFormat Night, TexelFormat Cloud>
+QRgb Renderer::shadePixel(double longitude, double latitude, double angle, float limb) const
+{
+    int r, g, b;
+    // only used where angle < shade_area, so never with shade_area == 0
+    const double shade_angle = angle * shade_scale;
 
-    if (mapnight != nullptr) {
+    if (Night != TexelFormat::none) {
         if (angle > shade_area) {
-            getMapColorLinear(map, longitude, latitude, &r, &g, &b);
+            mapColor<Day>(day_tex, longitude, latitude, limb, &r, &g, &b);
         }
         else if (angle < -0.1) {
-            getMapColorLinear(mapnight, longitude, latitude, &r, &g, &b);
+            mapColor<Night>(night_tex, longitude, latitude, limb, &r, &g, &b);
         }
         else if (angle > 0.1) {
-            getMapColorLinear(map, longitude, latitude, &r, &g, &b);
+            mapColor<Day>(day_tex, longitude, latitude, limb, &r, &g, &b);
             r = r * (ambientRed + shade_angle * (1. - ambientRed));
             g = g * (ambientGreen + shade_angle * (1. - ambientGreen));
             b = b * (ambientBlue + shade_angle * (1. - ambientBlue));
@@ -689,8 +1406,8 @@ unsigned int Renderer::getPixelColor(double longitude, double latitude,
             double x;
             int nr, ng, nb; // rgb values of night pixel
 
-            getMapColorLinear(map, longitude, latitude, &r, &g, &b);
-            getMapColorLinear(mapnight, longitude, latitude, &nr, &ng, &nb);
+            mapColor<Day>(day_tex, longitude, latitude, limb, &r, &g, &b);
+            mapColor<Night>(night_tex, longitude, latitude, limb, &nr, &ng, &nb);
             x = -5.0 * angle + 0.5;
             if (angle > 0.) {
                 r = x * nr + (1.0 - x) * r * (ambientRed + shade_angle * (1. - ambientRed));
@@ -705,7 +1422,7 @@ unsigned int Renderer::getPixelColor(double longitude, double latitude,
         }
     }
     else {
-        getMapColorLinear(map, longitude, latitude, &r, &g, &b);
+        mapColor<Day>(day_tex, longitude, latitude, limb, &r, &g, &b);
         if (angle < shade_area && angle > 0.) {
             r *= ambientRed + shade_angle * (1. - ambientRed);
             g *= ambientGreen + shade_angle * (1. - ambientGreen);
@@ -719,9 +1436,9 @@ unsigned int Renderer::getPixelColor(double longitude, double latitude,
     }
 
     // correct luminosity for clouds
-    if (mapcloud != nullptr) {
+    if (Cloud != TexelFormat::none) {
         int cr, cg, cb;
-        getMapColorLinear(mapcloud, longitude, latitude, &cr, &cg, &cb);
+        mapColor<Cloud>(cloud_tex, longitude, latitude, limb, &cr, &cg, &cb);
         if (cr >= 0) {
             int ar, ag, ab;
             // compute ambient light value
@@ -758,68 +1475,13 @@ unsigned int Renderer::getPixelColor(double longitude, double latitude,
     return qRgb(r, g, b);
 }
 
-void Renderer::getMapColorLinear(std::shared_ptr<QImage> const& m, double longitude, double latitude,
+void Renderer::getMapColorLinear(const Texture& t, double longitude, double latitude,
     int* r, int* g, int* b)
 {
-    latitude += M_PI / 2;
-    longitude += M_PI;
-    double posx = longitude * m->width() / (2 * M_PI);
-    double posy = latitude * m->height() / M_PI;
-
-    if (posy >= m->height()) {
-        posy = 2 * m->height() - posy;
-        posx += m->width() / 2;
-    }
-    else if (posy < 0) {
-        posy = -posy;
-        posx += m->width() / 2;
-    }
-    while (posx >= m->width())
-        posx -= m->width();
-    while (posx < 0)
-        posx += m->width();
-
-    int x11 = (int)posx;
-    int y1 = (int)posy;
-    int x12 = x11 + 1;
-    if (x12 == m->width())
-        x12 = 0;
-    int x21 = x11;
-    int y2 = y1 + 1;
-    if (y2 == m->height()) {
-        y2--;
-        x21 = x11 + m->width() / 2;
-        if (x21 >= m->width())
-            x21 -= m->width();
-    }
-    int x22 = x12;
-    double dx = posx - x11;
-    double dy = posy - y1;
-
-    QRgb c11, c12, c21, c22;
-
-    // offset into map pixel data
-    if (m->depth() == 32) {
-        QRgb* p = scan32(*m, 0, y1);
-        c11 = p[x11];
-        c12 = p[x12];
-        p = scan32(*m, 0, y2);
-        c21 = p[x21];
-        c22 = p[x22];
-    }
-    else //m->depth() == 8
-    {
-        unsigned char* p = (unsigned char*)m->scanLine(y1);
-        c11 = m->color(p[x11]);
-        c12 = m->color(p[x12]);
-        p = (unsigned char*)m->scanLine(y2);
-        c21 = m->color(p[x21]);
-        c22 = m->color(p[x22]);
-    }
-
-    *r = (int)((qRed(c22) * dx + qRed(c21) * (1 - dx)) * dy + (qRed(c12) * dx + qRed(c11) * (1 - dx)) * (1 - dy));
-    *g = (int)((qGreen(c22) * dx + qGreen(c21) * (1 - dx)) * dy + (qGreen(c12) * dx + qGreen(c11) * (1 - dx)) * (1 - dy));
-    *b = (int)((qBlue(c22) * dx + qBlue(c21) * (1 - dx)) * dy + (qBlue(c12) * dx + qBlue(c11) * (1 - dx)) * (1 - dy));
+    const QRgb c = t.sample(longitude, latitude);
+    *r = qRed(c);
+    *g = qGreen(c);
+    *b = qBlue(c);
 }
 
 void Renderer::drawMarkers()
@@ -948,9 +1610,9 @@ void Renderer::drawGrid()
     }
 }
 
-std::shared_ptr<QImage> Renderer::getImage()
+std::shared_ptr<const QImage> Renderer::getImage()
 {
-    return std::make_shared<QImage>(*renderedImage);
+    return frames.latest();
 }
 
 void Renderer::drawLabel()
@@ -995,20 +1657,17 @@ void Renderer::drawLabel()
     QRect br = fm.boundingRect(0, 0, 0, 0, Qt::AlignLeft | Qt::AlignTop,
         labelstring);
 
-    QPixmap pm(br.width() + 10, br.height() + 10);
+    // not a QPixmap, this runs on the render thread
+    QImage labelimage(br.width() + 10, br.height() + 10, QImage::Format_RGB32);
 
-    p.begin(&pm);
+    p.begin(&labelimage);
     p.setFont(labelFont);
-    p.fillRect(0, 0, pm.width(), pm.height(), transparentcolor);
+    p.fillRect(0, 0, labelimage.width(), labelimage.height(), transparentcolor);
     p.setPen(whitecolor);
     p.drawText(5, 5, br.width(), br.height(), Qt::AlignLeft | Qt::AlignTop,
         labelstring);
     p.end();
 
-    QImage labelimage = pm.toImage();
-    if (labelimage.depth() != 32)
-        labelimage = labelimage.convertToFormat(QImage::Format_RGB32);
-
     if (label_x > 0)
         x = label_x;
     else
@@ -1046,6 +1705,7 @@ void Renderer::setStars(double f, bool show)
 {
     if (show && renderedImage)
         stars = std::make_unique<Stars>(f, *renderedImage);
+    full_redraw = true;
 }
 
 void Renderer::drawStars()
@@ -46,17 +46,26 @@
  */
 #pragma once
 
+#include "cloudloader.h"
 #include "file.h"
+#include "framering.h"
 #include "markerlist.h"
 #include "random.h"
+#include "sphere_kernel.h"
 #include "stars.h"
+#include "surface_cache.h"
+#include "texture.h"
+#include "workpool.h"
 
 #include <QColor>
 #include <QImage>
-#include <QPixmap>
+#include <QRegion>
 #include <QSize>
 #include <QString>
+#include <atomic>
 #include <ctime>
+#include <future>
+#include <memory>
 
 enum class GridType { no, dull, nice };
 
@@ -68,8 +77,19 @@ static inline QRgb *scan32(QImage &img, int x, int y)
 
 class Renderer {
 public:
+    /* the files loadMaps() reads, empty for a layer left out */
+    struct MapFiles {
+        QString day;
+        QString night;
+        QString cloud;
+        QString back;
+        int cloud_filter = 110;
+        bool tiled_back = false;
+    };
+
     Renderer(const QSize& size, const QString& mapfile = QString());
     ~Renderer();
+    void loadMaps(const MapFiles& files);
     int loadNightMap(const QString& nmapfile = nullptr);
     int loadCloudMap(const QString& cmapfile = QString(), int cloud_filter = 110);
     void loadBackImage(const QString& imagefile = nullptr, bool tld = false);
@@ -78,6 +98,7 @@ public:
     double getViewLat();
     double getViewLong();
     double getSunLat();
+    int getProjectedRadius(); // in pixels, as of the last frame
     double getSunLong();
     void setRotation(double r);
     double getRotation();
@@ -101,18 +122,72 @@ public:
     void setGridType(GridType);
     GridType getGridType();
     double getStarFrequency();
-    std::shared_ptr<QImage> getImage();
+    /* the last finished frame, borrowed, see FrameRing */
+    std::shared_ptr<const QImage> getImage();
     void setShift(int x, int y);
     int getShiftX();
     int getShiftY();
     void setTransition(double t);
     double getTransition();
+    void setNumThreads(int num);
+    int getNumThreads();
+    bool setKernel(KernelType type);
+    void setSunRelative(bool follow);
+    void setIncremental(bool on);
+    void setIdlePriority(bool on); // of the worker threads
+    void setMipmap(MipMode mode);
+    void setTextureLayout(TexLayout layout);
+    void setNightTint(bool on); // before the night map is loaded
+    void benchmark(int frames);
+    size_t getRefreshedPixels();
+    /* the part of getImage() that changed since the last call */
+    QRegion takeChangedRegion();
 
 protected:
-    std::shared_ptr<QImage> loadImage(const QString&);
+    struct MapData {
+        std::shared_ptr<QImage> image;
+        std::shared_ptr<TileStore> tiles; // instead of image when paged
+    };
+    struct FittedMaps {
+        std::shared_ptr<QImage> day;
+        std::shared_ptr<QImage> night;
+    };
+
+    static std::shared_ptr<QImage> loadImage(const QString&);
+    static std::shared_ptr<TileStore> openTiles(const QString&);
+    static MapData readMap(const QString&);
+    Texture mapTexture(std::shared_ptr<QImage> const&, std::shared_ptr<TileStore> const&) const;
+    std::shared_ptr<QImage> fitImage(std::shared_ptr<QImage> const&) const;
+    void fitMaps();
+    static std::shared_ptr<QImage> grayImage(std::shared_ptr<QImage> const&);
+    static std::shared_ptr<QImage> tintImage(std::shared_ptr<QImage> const&);
 
 private:
-    void getMapColorLinear(std::shared_ptr<QImage> const&, double longitude, double latitude,
+    struct Tile {
+        int x0, y0; // upper left pixel, before shifting
+        int x1, y1; // lower right pixel
+    };
+    static const int tile_size = 64;
+
+    // where renderTile gets the surface positions from
+    enum class SurfacePass { trace, store, cached, update };
+
+    bool rowSpan(int py, int& startx, int& endx) const;
+    void pageTextures(const SphereSetup& setup, int starty, int endy);
+    template <TexelFormat Day, TexelFormat Night, TexelFormat Cloud>
+    size_t renderTile(const Tile& tile, const SphereSetup& setup, SurfacePass pass);
+    template <TexelFormat Day, TexelFormat Night, TexelFormat Cloud>
+    QRgb shadePixel(double longitude, double latitude, double angle, float limb) const;
+    void selectPipeline();
+    template <TexelFormat Cloud>
+    void pickNight();
+    template <TexelFormat Night, TexelFormat Cloud>
+    void pickDay();
+    void filterCloudMap(QImage& image, WorkPool& workers) const;
+    std::shared_ptr<QImage> cloudImage(const QString& path, WorkPool& workers) const;
+    WorkPool& workPool();
+    int lightClass(double angle) const;
+    inline void getMapColorLinear(const Texture&, double longitude, double latitude,
         int* r, int* g, int* b);
     unsigned int getPixelColor(double longitude, double latitude,
         double angle);
@@ -126,11 +201,17 @@ private:
     static int compareLocations(const void* l1, const void* l2);
 
 protected:
-    std::shared_ptr<QImage> map;
+    std::shared_ptr<QImage> map; // the maps at full size, until fitMaps()
     std::shared_ptr<QImage> mapnight;
+    std::shared_ptr<TileStore> day_store; // instead of map and mapnight when paged
+    std::shared_ptr<TileStore> night_store;
     std::shared_ptr<QImage> mapcloud;
     std::shared_ptr<QImage> backImage;
-    std::shared_ptr<QImage> renderedImage;
+    FrameRing frames;
+    QImage* renderedImage; // the buffer of frames drawn into
+    Texture day_tex; // samplers of the maps
+    Texture night_tex;
+    Texture cloud_tex;
     TMarkerListPtr markerlist;
     bool show_label;
     int label_x;
@@ -141,7 +222,14 @@ protected:
 private:
     bool tiled;
     bool clouds_ok;
-    std::unique_ptr<FileChange> track_clouds;
+    std::unique_ptr<CloudLoader> cloud_loader;
+    QString cloud_file;
+    int cloud_filter; // sharpening of the cloud map, see v
+    QString map_file; // to load them again for another size of the globe
+    QString night_file;
+    std::atomic<int> map_limit; // width the maps were scaled down to, 0 while unscaled
+    std::future<FittedMaps> refit; // the maps loaded again for map_limit, see fitMaps()
+    bool night_tint; // night map as brightness and one color, tinted once scaled
 
     // stuff used for rendering
     double view_lat;
@@ -155,18 +243,37 @@ private:
     double center_dist; // distance to center of earth
     double ambientRed, ambientGreen, ambientBlue;
     double shade_area;
+    double shade_scale; // 1 / shade_area
     double light_x, // vector of sunlight with length 1
         light_y,
         light_z;
     double fov; // field of view
     double zoom;
     int radius_proj; // radius of sphere on screen
+    MipMode mip_mode;
+    TexLayout tex_layout;
     GridType gridtype;
     double d_gridline; // dist. of grid lines in radians
     double d_griddot; // dist. of grid dots in radians
     double trans; // specifies the smoothness of the transition
         // from day to night
     Gen gen;
+    int num_threads;
+    SphereKernel kernel;
+    SurfaceCache surface;
+    SurfaceKey last_key; // view of the previous frame
+    bool sun_relative; // view follows the sun, see renderFrame()
+    double surface_long; // view_long the surface cache was traced for
+    double lon_offset; // view_long - surface_long
+    bool incremental; // only repaint what the sun moved, see renderFrame()
+    bool full_redraw; // something besides the time changed
+    size_t refreshed_pixels; // painted by the last renderFrame()
+    QRegion changed; // since takeChangedRegion()
+    // render loop and pixel shader for the loaded maps, see selectPipeline()
+    size_t (Renderer::*tile_fn)(const Tile&, const SphereSetup&, SurfacePass);
+    QRgb (Renderer::*pixel_fn)(double, double, double, float) const;
+    std::unique_ptr<WorkPool> pool;
+    bool idle_priority; // of the threads in pool
     std::unique_ptr<Stars> stars;
     unsigned char v[256]; // values for cloud
 };
@@ -0,0 +1,13 @@
+#include "renderthread.h"
+#include "renderer.h"
+
+RenderThread::RenderThread(Renderer& r, QObject* parent)
+    : QThread(parent),
+      renderer(r)
+{
+}
+
+void RenderThread::run()
+{
+    renderer.renderFrame();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <QThread>
+
+class Renderer;
+
+/*
+ * Runs Renderer::renderFrame() away from the GUI thread. QThread::finished()
+ * tells the owner that the frame is ready; the renderer must not be touched
+ * from elsewhere while the thread is running.
+ */
+class RenderThread : public QThread {
+    Q_OBJECT
+
+public:
+    RenderThread(Renderer& renderer, QObject* parent = nullptr);
+
+protected:
+    void run() override;
+
+private:
+    Renderer& renderer;
+};
@@ -0,0 +1,297 @@
+#include "rootpixmap.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#ifdef XGLOBE_X11ROOT
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+// after Qt, Xlib defines None, Bool, Status...
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xlibint.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+struct RootPixmap::Connection {
+    Display* display = nullptr;
+    Window root = 0;
+    Visual* visual = nullptr;
+    int depth = 0;
+    bool have_shm = false; // the server has MIT-SHM
+    bool shared = false; // image is in shared memory
+    XShmSegmentInfo shm;
+    XImage* image = nullptr;
+    Pixmap shown = 0; // the root window background
+    GC gc = nullptr;
+};
+
+namespace {
+
+// the last error on each of our displays, see failed()
+std::mutex error_lock;
+std::map<Display*, int> errors;
+
+/*
+ * Error hook of our own display. XSetErrorHandler() would replace the
+ * handler of the whole process, on all threads.
+ */
+int catchError(Display* d, xError* error, XExtCodes*, int*)
+{
+    std::lock_guard<std::mutex> hold(error_lock);
+    errors[d] = error->errorCode;
+    return 1; // handled, not passed on to the default handler
+}
+
+/* waits for the server and tells whether a request since the last call failed */
+bool failed(Display* d)
+{
+    XSync(d, False);
+    std::lock_guard<std::mutex> hold(error_lock);
+    const int code = errors[d];
+    errors[d] = 0;
+    return code != 0;
+}
+
+Atom atom(Display* d, const char* name)
+{
+    return XInternAtom(d, name, False);
+}
+
+/* 8 bit channel value v at the bits of mask */
+unsigned long channel(unsigned int v, unsigned long mask)
+{
+    if (!mask)
+        return 0;
+    int shift = 0;
+    while (!(mask & 1ul << shift))
+        shift++;
+    int bits = 0;
+    while (mask & 1ul << (shift + bits))
+        bits++;
+    return (bits >= 8 ? (unsigned long)v << (bits - 8) : v >> (8 - bits)) << shift;
+}
+
+}
+#else
+struct RootPixmap::Connection {
+};
+#endif
+
+void RootPixmap::initThreads()
+{
+#ifdef XGLOBE_X11ROOT
+    XInitThreads();
+#endif
+}
+
+RootPixmap::RootPixmap()
+    : x(new Connection)
+{
+#ifdef XGLOBE_X11ROOT
+    // normally done by main() already, set() runs on another thread
+    initThreads();
+    x->display = XOpenDisplay(nullptr);
+    if (!x->display) {
+        qWarning() << "Can't open the X display";
+        return;
+    }
+    XESetError(x->display, XAddExtension(x->display)->extension, catchError);
+    const int screen = DefaultScreen(x->display);
+    x->root = RootWindow(x->display, screen);
+    x->visual = DefaultVisual(x->display, screen);
+    x->depth = DefaultDepth(x->display, screen);
+    x->have_shm = XShmQueryExtension(x->display);
+    x->gc = XCreateGC(x->display, x->root, 0, nullptr);
+    qDebug() << "Root window background of depth" << x->depth
+             << (x->have_shm ? "with" : "without") << "MIT-SHM";
+#endif
+}
+
+RootPixmap::~RootPixmap()
+{
+#ifdef XGLOBE_X11ROOT
+    if (!x->display)
+        return;
+    release();
+    XFreeGC(x->display, x->gc);
+    // the background pixmap is kept, see set()
+    XCloseDisplay(x->display);
+    std::lock_guard<std::mutex> hold(error_lock);
+    errors.erase(x->display);
+#endif
+}
+
+bool RootPixmap::isValid() const
+{
+#ifdef XGLOBE_X11ROOT
+    return x->display != nullptr;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Image of the size of the frames.
+ */
+bool RootPixmap::prepare(int width, int height)
+{
+#ifdef XGLOBE_X11ROOT
+    Display* d = x->display;
+    if (x->image && x->image->width == width && x->image->height == height)
+        return true;
+    release();
+
+    if (x->have_shm) {
+        x->image = XShmCreateImage(d, x->visual, x->depth, ZPixmap, nullptr, &x->shm, width, height);
+        if (x->image) {
+            x->shm.shmid = shmget(IPC_PRIVATE, (size_t)x->image->bytes_per_line * height, IPC_CREAT | 0600);
+            x->shm.shmaddr = x->shm.shmid < 0 ? (char*)-1 : (char*)shmat(x->shm.shmid, nullptr, 0);
+            x->shm.readOnly = False;
+            x->shared = (x->shm.shmaddr != (char*)-1);
+            if (x->shared) {
+                // fails on a remote display
+                failed(d);
+                XShmAttach(d, &x->shm);
+                x->shared = !failed(d);
+            }
+            // freed once both sides have detached
+            if (x->shm.shmid >= 0)
+                shmctl(x->shm.shmid, IPC_RMID, nullptr);
+            if (x->shared) {
+                x->image->data = x->shm.shmaddr;
+            }
+            else {
+                qDebug() << "MIT-SHM doesn't work, sending the frames over the connection";
+                if (x->shm.shmaddr != (char*)-1)
+                    shmdt(x->shm.shmaddr);
+                XDestroyImage(x->image);
+                x->image = nullptr;
+                x->have_shm = false;
+            }
+        }
+    }
+    if (!x->image) {
+        x->image = XCreateImage(d, x->visual, x->depth, ZPixmap, 0, nullptr, width, height, 32, 0);
+        if (!x->image)
+            return false;
+        // XDestroyImage() frees it
+        x->image->data = static_cast<char*>(malloc((size_t)x->image->bytes_per_line * height));
+    }
+    return true;
+#else
+    Q_UNUSED(width);
+    Q_UNUSED(height);
+    return false;
+#endif
+}
+
+void RootPixmap::release()
+{
+#ifdef XGLOBE_X11ROOT
+    Display* d = x->display;
+    if (x->image) {
+        if (x->shared) {
+            XShmDetach(d, &x->shm);
+            XSync(d, False);
+            shmdt(x->shm.shmaddr);
+            x->image->data = nullptr;
+            x->shared = false;
+        }
+        XDestroyImage(x->image);
+        x->image = nullptr;
+    }
+#endif
+}
+
+bool RootPixmap::set(const QImage& frame)
+{
+#ifdef XGLOBE_X11ROOT
+    if (!isValid() || frame.isNull() || !prepare(frame.width(), frame.height()))
+        return false;
+    QElapsedTimer timer;
+    timer.start();
+
+    Display* d = x->display;
+    XImage* image = x->image;
+    const int w = frame.width();
+    const int h = frame.height();
+
+    // the usual 24 bit TrueColor takes the rows of RGB32 as they are
+    const int host_order = (Q_BYTE_ORDER == Q_LITTLE_ENDIAN) ? LSBFirst : MSBFirst;
+    const bool same = image->bits_per_pixel == 32 && image->byte_order == host_order
+        && image->red_mask == 0xff0000 && image->green_mask == 0xff00 && image->blue_mask == 0xff;
+    for (int y = 0; y < h; y++) {
+        const QRgb* src = reinterpret_cast<const QRgb*>(frame.constScanLine(y));
+        if (same) {
+            memcpy(image->data + (size_t)y * image->bytes_per_line, src, (size_t)w * sizeof(QRgb));
+            continue;
+        }
+        for (int px = 0; px < w; px++) {
+            XPutPixel(image, px, y, channel(qRed(src[px]), image->red_mask)
+                    | channel(qGreen(src[px]), image->green_mask)
+                    | channel(qBlue(src[px]), image->blue_mask));
+        }
+    }
+
+    // a new pixmap each time, the one on screen is never drawn into
+    Pixmap pixmap = XCreatePixmap(d, x->root, w, h, x->depth);
+    if (x->shared)
+        XShmPutImage(d, pixmap, x->gc, image, 0, 0, 0, 0, w, h, False);
+    else
+        XPutImage(d, pixmap, x->gc, image, 0, 0, 0, 0, w, h);
+    // the server is done with the shared image before the next frame
+    // is copied in
+    if (failed(d)) {
+        qWarning() << "Can't draw the root window background";
+        XFreePixmap(d, pixmap);
+        return false;
+    }
+
+    const Atom root_id = atom(d, "_XROOTPMAP_ID");
+    const Atom esetroot_id = atom(d, "ESETROOT_PMAP_ID");
+    if (!x->shown) {
+        // free the pixmap of the wallpaper setter before, which kept it
+        // like we do
+        Atom type;
+        int format;
+        unsigned long items, after;
+        unsigned char* data = nullptr;
+        if (XGetWindowProperty(d, x->root, esetroot_id, 0, 1, False, XA_PIXMAP, &type,
+                &format, &items, &after, &data) == Success && type == XA_PIXMAP && items == 1) {
+            XKillClient(d, *reinterpret_cast<Pixmap*>(data));
+            // fails when it is gone already
+            failed(d);
+        }
+        if (data)
+            XFree(data);
+        // the pixmaps stay after we're gone
+        XSetCloseDownMode(d, RetainPermanent);
+    }
+
+    // rewritten every time, that tells pseudo-transparent clients to
+    // look at the background again
+    XChangeProperty(d, x->root, root_id, XA_PIXMAP, 32, PropModeReplace,
+        reinterpret_cast<unsigned char*>(&pixmap), 1);
+    XChangeProperty(d, x->root, esetroot_id, XA_PIXMAP, 32, PropModeReplace,
+        reinterpret_cast<unsigned char*>(&pixmap), 1);
+    XSetWindowBackgroundPixmap(d, x->root, pixmap);
+    XClearWindow(d, x->root);
+    // the window keeps its own reference to the background
+    if (x->shown)
+        XFreePixmap(d, x->shown);
+    x->shown = pixmap;
+    if (failed(d))
+        qWarning() << "Can't set the root window background";
+
+    qDebug() << "Root window background set in" << timer.elapsed() << "ms";
+    return true;
+#else
+    Q_UNUSED(frame);
+    return false;
+#endif
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QImage>
+#include <memory>
+
+/*
+ * Sets the background of the X11 root window without going through an
+ * image file. Frames are copied into a shared memory XImage and from there
+ * into a new pixmap that becomes the root window background, announced in
+ * _XROOTPMAP_ID and ESETROOT_PMAP_ID for pseudo-transparent terminals and
+ * panels like Esetroot and xwallpaper do. Without MIT-SHM, e.g. on a
+ * remote display, the image goes over the connection instead.
+ *
+ * The pixmap outlives the program, the next wallpaper setter frees it.
+ * Only built where X11 is (XGLOBE_X11ROOT), elsewhere isValid() is false.
+ */
+class RootPixmap {
+public:
+    RootPixmap();
+    ~RootPixmap();
+
+    /* Xlib is used from more than one thread, call before QApplication */
+    static void initThreads();
+
+    bool isValid() const;
+    bool set(const QImage& frame);
+
+private:
+    struct Connection;
+    std::unique_ptr<Connection> x;
+
+    bool prepare(int width, int height);
+    void release();
+
+    // don't want to bother with copy
+    RootPixmap(const RootPixmap&) = delete;
+    RootPixmap& operator=(const RootPixmap&) = delete;
+};
@@ -0,0 +1,24 @@
+#include "schedule.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Schedule {
+
+double pixelTime(int radius)
+{
+    // the sun goes around once a day
+    const double speed = radius * 2. * M_PI / 86400.;
+    return speed > 0. ? 1. / speed : HUGE_VAL;
+}
+
+double interval(double pixel_time, double lag, double warp, double shortest, double longest)
+{
+    double next = std::min(pixel_time, longest);
+    // the next frame shows lag + next * warp past the last one
+    if (warp > 0.)
+        next = std::min(next, (pixel_time - lag) / warp);
+    return std::max(next, shortest);
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+ * Timing of the frames with -adaptive, see EarthApplication::nextInterval().
+ *
+ * A frame rendered at now, due interval seconds later, shows the time
+ * now + interval * warp. The shown time advances by the real time between
+ * the frames plus the change of that offset, not by warp times the
+ * interval.
+ */
+namespace Schedule {
+
+/* seconds of shown time the globe takes to change by about a pixel: the
+ * terminator, or with the view following the sun the whole surface,
+ * moves by up to radius pixels per radian the earth turns */
+double pixelTime(int radius);
+
+/*
+ * Seconds until the next frame, so that its shown time is at most
+ * pixel_time past the one of the last frame. lag is now minus the shown
+ * time of the last frame. Within [shortest, longest], shortest wins.
+ */
+double interval(double pixel_time, double lag, double warp, double shortest, double longest);
+
+}
@@ -0,0 +1,125 @@
+#include "sphere_kernel.h"
+
+#include <cmath>
+
+#if defined(XGLOBE_SIMD_X86)
+void sphereSse2(const SphereSetup&, double, double, int, const SurfaceSpan&);
+void sphereAvx2(const SphereSetup&, double, double, int, const SurfaceSpan&);
+void sphereAvx512(const SphereSetup&, double, double, int, const SurfaceSpan&);
+#endif
+
+/*
+ * Reference implementation, this is the arithmetic renderFrame always
+ * used. Kept for validating the vector kernels (-kernel scalar) and for
+ * cpus without one.
+ */
+static void sphereScalar(const SphereSetup& s, double dir_y, double dir_x,
+    int n, const SurfaceSpan& out)
+{
+    double a; // coeff. of quadratic equation
+    double radikand;
+    double wurzel;
+    double s1, s2, t; // distance between intersections and camera position
+    double sp_x, sp_y, sp_z; // intersection point of globe and ray
+    double hit_x, hit_y, hit_z; // hit position on earth surface
+    double longitude, latitude;
+    double r;
+
+    for (int i = 0; i < n; i++, dir_x += 1.) {
+        a = dir_x * dir_x + dir_y * dir_y + s.dir_z * s.dir_z;
+        radikand = s.b * s.b - 4 * a * s.c;
+        out.hit[i] = radikand >= 0.;
+        if (!out.hit[i])
+            continue;
+
+        wurzel = sqrt(radikand);
+        s1 = (-s.b + wurzel) / (2. * a);
+        s2 = (-s.b - wurzel) / (2. * a);
+        t = (s1 < s2) ? s1 : s2; // smaller solution belongs to nearer intersection
+        sp_x = t * dir_x; // sp = camera pos + t*dir
+        sp_y = t * dir_y;
+        sp_z = s.center_dist + t * s.dir_z;
+
+        hit_x = s.m[0] * sp_x + s.m[1] * sp_y + s.m[2] * sp_z;
+        hit_y = s.m[3] * sp_x + s.m[4] * sp_y + s.m[5] * sp_z;
+        hit_z = s.m[6] * sp_x + s.m[7] * sp_y + s.m[8] * sp_z;
+
+        r = sqrt(hit_x * hit_x + hit_z * hit_z);
+        if (r > 0.) {
+            longitude = atan(hit_x / hit_z);
+            if (hit_z < 0.)
+                longitude = M_PI + longitude;
+        }
+        else
+            longitude = 0.; // pole
+        latitude = atan(-hit_y / r);
+
+        out.lon[i] = longitude;
+        out.lat[i] = latitude;
+        out.nx[i] = hit_x * s.inv_radius;
+        out.ny[i] = hit_y * s.inv_radius;
+        out.nz[i] = hit_z * s.inv_radius;
+    }
+}
+
+static KernelType detectKernel()
+{
+#if defined(XGLOBE_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return KernelType::avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return KernelType::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return KernelType::sse2;
+#endif
+    return KernelType::scalar;
+}
+
+KernelType bestKernel()
+{
+    static const KernelType best = detectKernel();
+    return best;
+}
+
+/*
+ * @return the kernel for type or nullptr if this build or cpu can't run it
+ */
+SphereKernel sphereKernel(KernelType type)
+{
+    switch (type) {
+    case KernelType::automatic:
+        return sphereKernel(bestKernel());
+    case KernelType::scalar:
+        return sphereScalar;
+#if defined(XGLOBE_SIMD_X86)
+    case KernelType::sse2:
+        return __builtin_cpu_supports("sse2") ? sphereSse2 : nullptr;
+    case KernelType::avx2:
+        return __builtin_cpu_supports("avx2") ? sphereAvx2 : nullptr;
+    case KernelType::avx512:
+        return __builtin_cpu_supports("avx512f") ? sphereAvx512 : nullptr;
+#else
+    default:
+        break;
+#endif
+    }
+    return nullptr;
+}
+
+const char* kernelName(KernelType type)
+{
+    switch (type) {
+    case KernelType::automatic:
+        return kernelName(bestKernel());
+    case KernelType::scalar:
+        return "scalar";
+    case KernelType::sse2:
+        return "sse2";
+    case KernelType::avx2:
+        return "avx2";
+    case KernelType::avx512:
+        return "avx512";
+    }
+    return "unknown";
+}
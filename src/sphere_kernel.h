@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Ray/sphere intersection for a run of pixels of one screen row. For every
+ * pixel the kernel tells whether the ray hits the globe and where: texture
+ * coordinates (longitude, latitude in radians) and the unit surface normal
+ * in earth coordinates.
+ *
+ * The vector kernels always store whole vectors, so every output array
+ * needs room for n rounded up to a multiple of span_padding.
+ */
+
+enum class KernelType { automatic, scalar, sse2, avx2, avx512 };
+
+struct SphereSetup {
+    double m[9]; // rotation matrix, row major
+    double dir_z; // z of every cast ray (-proj_dist)
+    double b, c; // constant coeff. of quadratic equation
+    double center_dist; // distance camera - center of earth
+    double inv_radius;
+};
+
+struct SurfaceSpan {
+    float* lon;
+    float* lat;
+    float* nx;
+    float* ny;
+    float* nz;
+    unsigned char* hit;
+};
+
+static const int span_padding = 16;
+
+typedef void (*SphereKernel)(const SphereSetup&, double dir_y, double dir_x,
+    int n, const SurfaceSpan&);
+
+SphereKernel sphereKernel(KernelType type);
+KernelType bestKernel();
+const char* kernelName(KernelType type);
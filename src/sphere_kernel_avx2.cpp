@@ -0,0 +1,31 @@
+#include "sphere_kernel_simd.h"
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2 {
+    typedef __m256d D;
+    typedef __m256d M;
+    static const int lanes = 4;
+
+    static D set1(double a) { return _mm256_set1_pd(a); }
+    static D iota() { return _mm256_setr_pd(0., 1., 2., 3.); }
+    static D add(D a, D b) { return _mm256_add_pd(a, b); }
+    static D sub(D a, D b) { return _mm256_sub_pd(a, b); }
+    static D mul(D a, D b) { return _mm256_mul_pd(a, b); }
+    static D div(D a, D b) { return _mm256_div_pd(a, b); }
+    static D sqrt(D a) { return _mm256_sqrt_pd(a); }
+    static M lt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static D select(M m, D a, D b) { return _mm256_blendv_pd(b, a, m); }
+    static void store(float* p, D a) { _mm_storeu_ps(p, _mm256_cvtpd_ps(a)); }
+    static int bits(M m) { return _mm256_movemask_pd(m); }
+};
+
+}
+
+void sphereAvx2(const SphereSetup& s, double dir_y, double dir_x, int n,
+    const SurfaceSpan& out)
+{
+    sphereSpan<Avx2>(s, dir_y, dir_x, n, out);
+}
@@ -0,0 +1,31 @@
+#include "sphere_kernel_simd.h"
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx512 {
+    typedef __m512d D;
+    typedef __mmask8 M;
+    static const int lanes = 8;
+
+    static D set1(double a) { return _mm512_set1_pd(a); }
+    static D iota() { return _mm512_setr_pd(0., 1., 2., 3., 4., 5., 6., 7.); }
+    static D add(D a, D b) { return _mm512_add_pd(a, b); }
+    static D sub(D a, D b) { return _mm512_sub_pd(a, b); }
+    static D mul(D a, D b) { return _mm512_mul_pd(a, b); }
+    static D div(D a, D b) { return _mm512_div_pd(a, b); }
+    static D sqrt(D a) { return _mm512_sqrt_pd(a); }
+    static M lt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static D select(M m, D a, D b) { return _mm512_mask_blend_pd(m, b, a); }
+    static void store(float* p, D a) { _mm256_storeu_ps(p, _mm512_cvtpd_ps(a)); }
+    static int bits(M m) { return m; }
+};
+
+}
+
+void sphereAvx512(const SphereSetup& s, double dir_y, double dir_x, int n,
+    const SurfaceSpan& out)
+{
+    sphereSpan<Avx512>(s, dir_y, dir_x, n, out);
+}
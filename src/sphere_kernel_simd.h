@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+ * Vector version of the scalar reference kernel in sphere_kernel.cpp,
+ * written once against a small set of operations (V). Only included by the
+ * sphere_kernel_<isa>.cpp files, each compiled for its instruction set.
+ * Everything in here has internal linkage, so the linker can't mix up
+ * instantiations built for different cpus.
+ *
+ * V provides: the vector type D, the mask type M, lanes, set1(), iota(),
+ * add(), sub(), mul(), div(), sqrt(), lt(), select(m, if_true, if_false),
+ * store(float*, D) and bits(M).
+ */
+
+#include "sphere_kernel.h"
+
+namespace {
+
+template <class V>
+inline typename V::D atanv(typename V::D x)
+{
+    typedef typename V::D D;
+    // cephes atanf: reduce to |x| <= tan(pi/8), then a short polynomial
+    const D zero = V::set1(0.);
+    const D one = V::set1(1.);
+    const auto negative = V::lt(x, zero);
+    const D ax = V::select(negative, V::sub(zero, x), x);
+
+    const auto big = V::lt(V::set1(2.414213562373095), ax);
+    const auto mid = V::lt(V::set1(0.4142135623730950), ax);
+    D xr = V::select(mid, V::div(V::sub(ax, one), V::add(ax, one)), ax);
+    xr = V::select(big, V::div(V::set1(-1.), ax), xr);
+    D y = V::select(mid, V::set1(0.78539816339744830962), zero);
+    y = V::select(big, V::set1(1.57079632679489661923), y);
+
+    const D z = V::mul(xr, xr);
+    D p = V::set1(8.05374449538e-2);
+    p = V::sub(V::mul(p, z), V::set1(1.38776856032e-1));
+    p = V::add(V::mul(p, z), V::set1(1.99777106478e-1));
+    p = V::sub(V::mul(p, z), V::set1(3.33329491539e-1));
+    p = V::add(V::mul(V::mul(p, z), xr), xr);
+    y = V::add(y, p);
+
+    return V::select(negative, V::sub(zero, y), y);
+}
+
+template <class V>
+inline void sphereBlock(const SphereSetup& s, typename V::D dir_x,
+    typename V::D dir_y, double dir_yz2, int i, const SurfaceSpan& out)
+{
+    typedef typename V::D D;
+    const D zero = V::set1(0.);
+    const D b = V::set1(s.b);
+
+    const D a = V::add(V::mul(dir_x, dir_x), V::set1(dir_yz2));
+    D radikand = V::sub(V::set1(s.b * s.b), V::mul(V::mul(V::set1(4.), a), V::set1(s.c)));
+    const auto miss = V::lt(radikand, zero);
+    radikand = V::select(miss, zero, radikand);
+
+    // the smaller solution belongs to the nearer intersection
+    const D t = V::div(V::sub(V::sub(zero, b), V::sqrt(radikand)), V::mul(V::set1(2.), a));
+    const D sp_x = V::mul(t, dir_x);
+    const D sp_y = V::mul(t, dir_y);
+    const D sp_z = V::add(V::set1(s.center_dist), V::mul(t, V::set1(s.dir_z)));
+
+    const D hit_x = V::add(V::add(V::mul(V::set1(s.m[0]), sp_x), V::mul(V::set1(s.m[1]), sp_y)), V::mul(V::set1(s.m[2]), sp_z));
+    const D hit_y = V::add(V::add(V::mul(V::set1(s.m[3]), sp_x), V::mul(V::set1(s.m[4]), sp_y)), V::mul(V::set1(s.m[5]), sp_z));
+    const D hit_z = V::add(V::add(V::mul(V::set1(s.m[6]), sp_x), V::mul(V::set1(s.m[7]), sp_y)), V::mul(V::set1(s.m[8]), sp_z));
+
+    const D r = V::sqrt(V::add(V::mul(hit_x, hit_x), V::mul(hit_z, hit_z)));
+    const auto pole = V::lt(r, V::set1(1e-300));
+    D longitude = atanv<V>(V::div(hit_x, V::select(pole, V::set1(1.), hit_z)));
+    longitude = V::select(V::lt(hit_z, zero), V::add(longitude, V::set1(3.14159265358979323846)), longitude);
+    longitude = V::select(pole, zero, longitude);
+    const D latitude = atanv<V>(V::div(V::sub(zero, hit_y), V::select(pole, V::set1(1e-300), r)));
+
+    const D inv_radius = V::set1(s.inv_radius);
+    V::store(out.lon + i, longitude);
+    V::store(out.lat + i, latitude);
+    V::store(out.nx + i, V::mul(hit_x, inv_radius));
+    V::store(out.ny + i, V::mul(hit_y, inv_radius));
+    V::store(out.nz + i, V::mul(hit_z, inv_radius));
+
+    const int m = V::bits(miss);
+    for (int l = 0; l < V::lanes; l++)
+        out.hit[i + l] = !((m >> l) & 1);
+}
+
+template <class V>
+inline void sphereSpan(const SphereSetup& s, double dir_y, double dir_x,
+    int n, const SurfaceSpan& out)
+{
+    typedef typename V::D D;
+    const double dir_yz2 = dir_y * dir_y + s.dir_z * s.dir_z;
+    const D y = V::set1(dir_y);
+    const D step = V::set1(V::lanes);
+    D x = V::add(V::set1(dir_x), V::iota());
+
+    // two vectors per iteration, the tail is padded
+    for (int i = 0; i < n; i += 2 * V::lanes) {
+        sphereBlock<V>(s, x, y, dir_yz2, i, out);
+        x = V::add(x, step);
+        sphereBlock<V>(s, x, y, dir_yz2, i + V::lanes, out);
+        x = V::add(x, step);
+    }
+}
+
+}
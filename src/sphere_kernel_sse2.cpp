@@ -0,0 +1,31 @@
+#include "sphere_kernel_simd.h"
+
+#include <emmintrin.h>
+
+namespace {
+
+struct Sse2 {
+    typedef __m128d D;
+    typedef __m128d M;
+    static const int lanes = 2;
+
+    static D set1(double a) { return _mm_set1_pd(a); }
+    static D iota() { return _mm_setr_pd(0., 1.); }
+    static D add(D a, D b) { return _mm_add_pd(a, b); }
+    static D sub(D a, D b) { return _mm_sub_pd(a, b); }
+    static D mul(D a, D b) { return _mm_mul_pd(a, b); }
+    static D div(D a, D b) { return _mm_div_pd(a, b); }
+    static D sqrt(D a) { return _mm_sqrt_pd(a); }
+    static M lt(D a, D b) { return _mm_cmplt_pd(a, b); }
+    static D select(M m, D a, D b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+    static void store(float* p, D a) { _mm_storel_pi(reinterpret_cast<__m64*>(p), _mm_cvtpd_ps(a)); }
+    static int bits(M m) { return _mm_movemask_pd(m); }
+};
+
+}
+
+void sphereSse2(const SphereSetup& s, double dir_y, double dir_x, int n,
+    const SurfaceSpan& out)
+{
+    sphereSpan<Sse2>(s, dir_y, dir_x, n, out);
+}
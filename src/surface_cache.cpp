@@ -0,0 +1,96 @@
+#include "surface_cache.h"
+
+bool SurfaceKey::operator==(const SurfaceKey& k) const
+{
+    return view_lat == k.view_lat && view_long == k.view_long && rot == k.rot
+        && center_dist == k.center_dist && proj_dist == k.proj_dist
+        && shift_x == k.shift_x && shift_y == k.shift_y
+        && width == k.width && height == k.height;
+}
+
+bool SurfaceKey::operator!=(const SurfaceKey& k) const
+{
+    return !(*this == k);
+}
+
+SurfaceCache::SurfaceCache()
+    : key(),
+      valid(false),
+      first_row(0)
+{
+}
+
+void SurfaceCache::prepare(const SurfaceKey& k, int first, const std::vector<Row>& r,
+    bool with_light)
+{
+    key = k;
+    valid = false;
+    first_row = first;
+    rows = r;
+
+    offset.resize(rows.size());
+    size_t total = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        offset[i] = total;
+        if (rows[i].endx >= rows[i].startx)
+            total += rows[i].endx - rows[i].startx + 1;
+    }
+
+    lon.resize(total);
+    lat.resize(total);
+    nx.resize(total);
+    ny.resize(total);
+    nz.resize(total);
+    hit.resize(total);
+    if (with_light)
+        light_angle.resize(total);
+    else
+        std::vector<float>().swap(light_angle);
+}
+
+void SurfaceCache::clear()
+{
+    valid = false;
+    rows.clear();
+    offset.clear();
+    std::vector<float>().swap(lon);
+    std::vector<float>().swap(lat);
+    std::vector<float>().swap(nx);
+    std::vector<float>().swap(ny);
+    std::vector<float>().swap(nz);
+    std::vector<unsigned char>().swap(hit);
+    std::vector<float>().swap(light_angle);
+}
+
+void SurfaceCache::setValid()
+{
+    valid = true;
+}
+
+bool SurfaceCache::isValid(const SurfaceKey& k) const
+{
+    return valid && key == k;
+}
+
+SurfaceSpan SurfaceCache::span(int py, int px)
+{
+    const size_t i = offset[py - first_row] + (px - rows[py - first_row].startx);
+    return { &lon[i], &lat[i], &nx[i], &ny[i], &nz[i], &hit[i] };
+}
+
+bool SurfaceCache::hasLight() const
+{
+    return !light_angle.empty();
+}
+
+float* SurfaceCache::light(int py, int px)
+{
+    const size_t i = offset[py - first_row] + (px - rows[py - first_row].startx);
+    return &light_angle[i];
+}
+
+size_t SurfaceCache::memoryUsage() const
+{
+    return lon.size() * (5 * sizeof(float) + sizeof(unsigned char))
+        + light_angle.size() * sizeof(float);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "sphere_kernel.h"
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * Everything that decides where a screen pixel hits the globe. Two frames
+ * with the same key trace exactly the same rays.
+ */
+struct SurfaceKey {
+    double view_lat;
+    double view_long;
+    double rot;
+    double center_dist;
+    double proj_dist;
+    int shift_x;
+    int shift_y;
+    int width;
+    int height;
+
+    bool operator==(const SurfaceKey& k) const;
+    bool operator!=(const SurfaceKey& k) const;
+};
+
+/*
+ * Output of the sphere kernel for every visible globe pixel, stored row by
+ * row. While the key does not change, a frame only needs to light and
+ * shade the cached positions.
+ */
+class SurfaceCache {
+public:
+    SurfaceCache();
+
+    /* row py covers the pixels [startx, endx], endx < startx for none */
+    struct Row {
+        int startx;
+        int endx;
+    };
+
+    void prepare(const SurfaceKey& key, int first_row, const std::vector<Row>& rows,
+        bool with_light = false);
+    void clear();
+    void setValid();
+    bool isValid(const SurfaceKey& key) const;
+
+    /* cached positions of row py, starting at pixel px */
+    SurfaceSpan span(int py, int px);
+    /* cached light angles, only if prepared with_light */
+    bool hasLight() const;
+    float* light(int py, int px);
+    size_t memoryUsage() const;
+
+private:
+    SurfaceKey key;
+    bool valid;
+    int first_row;
+    std::vector<Row> rows;
+    std::vector<size_t> offset;
+
+    std::vector<float> lon;
+    std::vector<float> lat;
+    std::vector<float> nx;
+    std::vector<float> ny;
+    std::vector<float> nz;
+    std::vector<unsigned char> hit;
+    std::vector<float> light_angle;
+};
@@ -0,0 +1,345 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <cstring>
+
+Texture::Texture()
+    : indexed(false)
+    , gray(false)
+    , tex_layout(TexLayout::linear)
+    , base(nullptr)
+    , next(nullptr)
+    , resident(nullptr)
+    , lod_fraction(0.)
+    , blend(false)
+{
+}
+
+Texture::Texture(std::shared_ptr<QImage> const& img, TexLayout layout)
+    : Texture()
+{
+    if (!img || img->isNull())
+        return;
+
+    image = img;
+    const QImage& m = *image;
+    indexed = (m.depth() == 8);
+    if (m.format() == QImage::Format_Grayscale8) {
+        // no color table, the index is the gray value
+        for (int i = 0; i < 256; i++)
+            palette.push_back(qRgb(i, i, i));
+        gray = true;
+    }
+    else if (indexed) {
+        for (QRgb c : m.colorTable())
+            palette.push_back(c);
+        gray = (palette.size() == 256);
+        for (int i = 0; gray && i < 256; i++)
+            gray = (palette[i] == rampColor(palette[255], i));
+        palette.resize(256, qRgb(0, 0, 0));
+    }
+    if (gray)
+        indexed = false;
+
+    // constBits() doesn't detach, the pointer stays valid as long as
+    // nobody writes to the image
+    addLevel(m.constBits(), m.bytesPerLine(), m.width(), m.height());
+    if (!indexed && !gray)
+        chain[0].stride = m.bytesPerLine() / sizeof(QRgb);
+    buildLevels();
+    if (layout == TexLayout::tiled)
+        setLayout(layout);
+    base = &chain[0];
+    next = chain.size() > 1 ? &chain[1] : nullptr;
+}
+
+Texture::Texture(std::shared_ptr<TileStore> const& tiles, TexLayout layout)
+    : Texture()
+{
+    if (!tiles)
+        return;
+
+    store = tiles;
+    for (int n = 0; n < store->levels(); n++) {
+        addLevel(nullptr, 0, store->width(n), store->height(n));
+        chain.back().tiles_x = store->tilesX(n);
+        chain.back().pages = store->pages(n);
+    }
+    const QImage& m = store->resident();
+    addLevel(m.constBits(), m.bytesPerLine(), m.width(), m.height());
+    chain.back().stride = m.bytesPerLine() / sizeof(QRgb);
+    buildLevels();
+    if (layout == TexLayout::tiled)
+        setLayout(layout);
+    base = &chain[0];
+    next = chain.size() > 1 ? &chain[1] : nullptr;
+    resident = &chain[store->levels()];
+}
+
+void Texture::addLevel(const unsigned char* bits, int bytes_per_line, int w, int h)
+{
+    Level l;
+    l.bits = bits;
+    l.bytes_per_line = bytes_per_line;
+    l.stride = bytes_per_line; // fixed up for 32 bit levels
+    l.tiles_x = 0;
+    l.w = w;
+    l.h = h;
+    l.w_fix = (int64_t)w << 16;
+    l.h_fix = (int64_t)h << 16;
+    l.scale_x = l.w_fix / (2 * M_PI);
+    l.scale_y = l.h_fix / M_PI;
+    l.pages = nullptr;
+    chain.push_back(l);
+}
+
+/*
+ * Box filter every level down to the next, until one side is a single
+ * texel. Odd sizes round up, the last row or column is then used twice.
+ */
+void Texture::buildLevels()
+{
+    for (;;) {
+        const Level src = chain.back();
+        if (src.w < 2 || src.h < 2)
+            break;
+        const int w = (src.w + 1) / 2;
+        const int h = (src.h + 1) / 2;
+        const bool from_palette = indexed && chain.size() == 1;
+        const int size = gray ? 1 : sizeof(QRgb);
+
+        auto texel = [&](int x, int y) -> uint64_t {
+            x = std::min(x, src.w - 1);
+            y = std::min(y, src.h - 1);
+            const unsigned char* line = src.bits + (size_t)y * src.bytes_per_line;
+            if (gray)
+                return line[x];
+            if (from_palette)
+                return spread(palette[line[x]]);
+            return spread(reinterpret_cast<const QRgb*>(line)[x]);
+        };
+
+        std::unique_ptr<unsigned char[]> pixels(new unsigned char[(size_t)w * h * size]);
+        for (int y = 0; y < h; y++) {
+            unsigned char* p = pixels.get() + (size_t)y * w * size;
+            for (int x = 0; x < w; x++) {
+                // lanes are 16 bit wide, the sum of four fits
+                const uint64_t sum = texel(2 * x, 2 * y) + texel(2 * x + 1, 2 * y)
+                    + texel(2 * x, 2 * y + 1) + texel(2 * x + 1, 2 * y + 1)
+                    + 0x0002000200020002ull;
+                const uint64_t c = (sum >> 2) & 0x00ff00ff00ff00ffull;
+                if (gray)
+                    p[x] = (unsigned char)c;
+                else
+                    reinterpret_cast<QRgb*>(p)[x] = pack(c);
+            }
+        }
+        addLevel(pixels.get(), w * size, w, h);
+        chain.back().stride = w;
+        mip_pixels.push_back(std::move(pixels));
+    }
+}
+
+/*
+ * Copy every level into 16x16 tiles, padded to whole tiles. The row
+ * copies of the levels aren't needed afterwards.
+ */
+void Texture::tileLevels()
+{
+    const int tile = 1 << tile_shift;
+    for (size_t n = 0; n < chain.size(); n++) {
+        Level& l = chain[n];
+        if (l.pages)
+            continue; // tiles of their own already
+        const int size = texelSize(n);
+        const int tiles_x = (l.w + tile - 1) / tile;
+        const int tiles_y = (l.h + tile - 1) / tile;
+
+        Level t = l;
+        t.tiles_x = tiles_x;
+        std::unique_ptr<unsigned char[]> pixels(
+            new unsigned char[(size_t)tiles_x * tiles_y * tile * tile * size]());
+        for (int y = 0; y < l.h; y++) {
+            const unsigned char* src = l.bits + (size_t)y * l.bytes_per_line;
+            const size_t row = rowOffset(t, y);
+            for (int x = 0; x < l.w; x++)
+                memcpy(pixels.get() + (row + columnOffset(t, x)) * size, src + x * size, size);
+        }
+        l.bits = pixels.get();
+        l.tiles_x = tiles_x;
+        tiled_pixels.push_back(std::move(pixels));
+    }
+    mip_pixels.clear();
+    image.reset();
+    tex_layout = TexLayout::tiled;
+}
+
+/* the other way around, level 0 isn't the image any more afterwards */
+void Texture::untileLevels()
+{
+    for (size_t n = 0; n < chain.size(); n++) {
+        Level& l = chain[n];
+        if (l.pages || !l.tiles_x)
+            continue;
+        const int size = texelSize(n);
+        std::unique_ptr<unsigned char[]> pixels(new unsigned char[(size_t)l.w * l.h * size]);
+        for (int y = 0; y < l.h; y++) {
+            unsigned char* dst = pixels.get() + (size_t)y * l.w * size;
+            const size_t row = rowOffset(l, y);
+            for (int x = 0; x < l.w; x++)
+                memcpy(dst + x * size, l.bits + (row + columnOffset(l, x)) * size, size);
+        }
+        l.bits = pixels.get();
+        l.bytes_per_line = l.w * size;
+        l.stride = size == 1 ? l.bytes_per_line : l.w;
+        l.tiles_x = 0;
+        mip_pixels.push_back(std::move(pixels));
+    }
+    tiled_pixels.clear();
+    tex_layout = TexLayout::linear;
+}
+
+void Texture::setLayout(TexLayout layout)
+{
+    if (layout == tex_layout || chain.empty())
+        return;
+    if (layout == TexLayout::tiled)
+        tileLevels();
+    else
+        untileLevels();
+}
+
+void Texture::selectLevel(int radius_proj, MipMode mode)
+{
+    if (chain.empty())
+        return;
+
+    // map texels per screen pixel at the center of the globe
+    const Level& top = chain[0];
+    const double texels = std::max(top.w / (2 * M_PI), top.h / M_PI) / std::max(radius_proj, 1);
+    const double lod = (mode == MipMode::off) ? 0. : std::max(0., std::log2(texels));
+
+    const int n = std::min((int)lod, (int)chain.size() - 1);
+    base = &chain[n];
+    next = (n + 1 < (int)chain.size()) ? &chain[n + 1] : nullptr;
+    lod_fraction = lod - n;
+    blend = (mode == MipMode::blend);
+}
+
+int Texture::level() const
+{
+    return base ? base - &chain[0] : 0;
+}
+
+void Texture::request(double longitude, double latitude)
+{
+    if (!store)
+        return;
+    requestLevel(*base, longitude, latitude);
+    if (blend && next)
+        requestLevel(*next, longitude, latitude);
+}
+
+/*
+ * All tiles within a few texels, so that a sample every few pixels is
+ * enough to find the tiles of the whole view.
+ */
+void Texture::requestLevel(const Level& l, double longitude, double latitude)
+{
+    if (!l.pages)
+        return;
+    const int n = &l - &chain[0];
+    const int margin = 8;
+    const int shift = TileStore::tile_shift;
+
+    int64_t fx, fy;
+    position(l, longitude, latitude, fx, fy);
+    const int x = (int)(fx >> 16);
+    const int y = (int)(fy >> 16);
+
+    for (int dy = -margin; dy <= margin; dy += 2 * margin) {
+        const int ty = std::min(std::max(y + dy, 0), l.h - 1) >> shift;
+        for (int dx = -margin; dx <= margin; dx += 2 * margin) {
+            int tx = x + dx;
+            if (tx < 0)
+                tx += l.w;
+            else if (tx >= l.w)
+                tx -= l.w;
+            store->need(n, tx >> shift, ty);
+        }
+    }
+    // the last row blends with the opposite meridian, see bilinear()
+    if (y + margin >= l.h - 1) {
+        const int tx = (x + l.w / 2) % l.w;
+        store->need(n, tx >> shift, (l.h - 1) >> shift);
+    }
+}
+
+void Texture::pageIn()
+{
+    if (store)
+        store->pageIn();
+}
+
+bool Texture::isVirtual() const
+{
+    return store != nullptr;
+}
+
+bool Texture::isNull() const
+{
+    return base == nullptr;
+}
+
+int Texture::texelSize(size_t level) const
+{
+    return (gray || (indexed && level == 0)) ? 1 : sizeof(QRgb);
+}
+
+TexelFormat Texture::format() const
+{
+    if (!base)
+        return TexelFormat::none;
+    if (gray)
+        return TexelFormat::gray8;
+    return (indexed && base == &chain[0]) ? TexelFormat::indexed8 : TexelFormat::rgb32;
+}
+
+int Texture::width() const
+{
+    return base ? base->w : 0;
+}
+
+int Texture::height() const
+{
+    return base ? base->h : 0;
+}
+
+int Texture::levels() const
+{
+    return chain.size();
+}
+
+TexLayout Texture::layout() const
+{
+    return tex_layout;
+}
+
+size_t Texture::memoryUsage() const
+{
+    const int tile = 1 << tile_shift;
+    size_t n = 0;
+    for (size_t i = 0; i < chain.size(); i++) {
+        const Level& l = chain[i];
+        const size_t size = texelSize(i);
+        if (l.pages)
+            continue;
+        if (l.tiles_x)
+            n += (size_t)l.tiles_x * tile * ((l.h + tile - 1) / tile) * tile * size;
+        else if (&l != resident) // that one is counted by the store
+            n += (size_t)l.h * l.bytes_per_line;
+    }
+    if (store)
+        n += store->memoryUsage();
+    return n;
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include "tilestore.h"
+
+#include <QColor>
+#include <QImage>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/* storage of a map, none for a layer that isn't loaded. gray8 is one
+ * brightness byte per texel, shown as a ramp from black to a tint color */
+enum class TexelFormat { none, rgb32, indexed8, gray8 };
+
+/* use of the mip levels: always the full map, one level per frame, or
+ * blending two levels by the size of the pixel on the globe */
+enum class MipMode { off, level, blend };
+
+/* memory order of the texels: rows like QImage, or 16x16 tiles with the
+ * texels of a tile in Z-order, so that neighbours on the map are mostly
+ * neighbours in memory too */
+enum class TexLayout { linear, tiled };
+
+/*
+ * Bilinear lookup of an equirectangular map. Texture coordinates are kept
+ * as 16.16 fixed point, the four neighbours are blended with all channels
+ * packed into one 64 bit word. Same results as the old floating point
+ * getMapColorLinear() up to rounding of the last bit.
+ *
+ * Next to the map itself a chain of mip levels is built, each half the
+ * size of the one before and always 32 bit. When the globe is small on
+ * screen, selectLevel() switches to the level that has about one texel
+ * per screen pixel, which doesn't alias and touches far less memory.
+ * With TexLayout::tiled every level is copied into tiles instead, the
+ * image isn't kept alive then.
+ *
+ * Grayscale8 maps, and 8 bit maps whose color table is rampColor() of its
+ * last entry, are gray8: their mip levels stay 8 bit, the color is looked
+ * up after filtering.
+ *
+ * A texture made from a TileStore has the large levels paged: request()
+ * the texels the view will sample, then pageIn() before rendering. Where
+ * a tile is missing anyway, the lookup falls back to the resident level.
+ */
+class Texture {
+public:
+    Texture();
+    explicit Texture(std::shared_ptr<QImage> const& image, TexLayout layout = TexLayout::linear);
+    explicit Texture(std::shared_ptr<TileStore> const& store, TexLayout layout = TexLayout::linear);
+
+    bool isNull() const;
+    /* format of the current level */
+    TexelFormat format() const;
+    int width() const;
+    int height() const;
+    int levels() const;
+    TexLayout layout() const;
+    /* copies the levels into the layout */
+    void setLayout(TexLayout layout);
+    size_t memoryUsage() const; // of the levels it keeps, the image included
+    bool isVirtual() const; // made from a TileStore
+
+    /* pick the level for a globe of radius_proj pixels on screen */
+    void selectLevel(int radius_proj, MipMode mode);
+    int level() const;
+
+    /* entry i of the color table of a gray8 map with tint color c */
+    static inline QRgb rampColor(QRgb c, int i);
+
+    /* the current level(s) will be sampled around longitude, latitude */
+    void request(double longitude, double latitude);
+    void pageIn();
+
+    /* longitude in [-pi, pi] (wraps), latitude in [-pi/2, pi/2] */
+    inline QRgb sample(double longitude, double latitude) const;
+    /*
+     * The same without checking the format at run time. limb is log2 of
+     * how much more map a screen pixel covers than one at the center of
+     * the globe, only used with MipMode::blend.
+     */
+    template <TexelFormat F>
+    inline QRgb sample(double longitude, double latitude, float limb = 0.f) const;
+
+private:
+    static const int tile_shift = 4; // 16x16 texels
+
+    struct Level {
+        const unsigned char* bits;
+        int bytes_per_line; // of the QImage or mip level rows
+        int stride; // linear layout, texels per row
+        int tiles_x; // tiled layout, tiles per row
+        int w, h;
+        int64_t w_fix, h_fix; // size in 16.16
+        double scale_x, scale_y; // radians to 16.16 texels
+        const QRgb* const* pages; // paged level, tiles of the TileStore
+    };
+
+    void addLevel(const unsigned char* bits, int bytes_per_line, int w, int h);
+    void buildLevels();
+    void tileLevels();
+    void untileLevels();
+    void requestLevel(const Level& l, double longitude, double latitude);
+    int texelSize(size_t level) const;
+
+    static inline size_t interleave(unsigned int v);
+    static inline size_t rowOffset(const Level& l, int y);
+    static inline size_t columnOffset(const Level& l, int x);
+    static inline void position(const Level& l, double longitude, double latitude,
+        int64_t& fx, int64_t& fy);
+    template <TexelFormat F>
+    inline QRgb texel(const Level& l, size_t i) const;
+    static inline uint64_t spread(QRgb c);
+    static inline uint64_t lerp(uint64_t a, uint64_t b, unsigned int w);
+    static inline QRgb pack(uint64_t c);
+    template <TexelFormat F>
+    inline uint64_t bilinear(const Level& l, double longitude, double latitude) const;
+
+    std::shared_ptr<QImage> image; // keeps the pixel data of linear level 0 alive
+    std::shared_ptr<TileStore> store; // or the tiles
+    bool indexed; // level 0 is 8 bit
+    bool gray; // all levels are 8 bit, palette is a ramp
+    std::vector<QRgb> palette; // for 8 bit maps, always 256 entries
+    std::vector<Level> chain;
+    std::vector<std::unique_ptr<unsigned char[]>> mip_pixels; // linear levels besides image
+    std::vector<std::unique_ptr<unsigned char[]>> tiled_pixels; // all levels
+    TexLayout tex_layout;
+    const Level* base; // the level selectLevel() picked
+    const Level* next; // the one after, nullptr for the last
+    const Level* resident; // first level not paged
+    double lod_fraction; // how far the globe center is towards *next
+    bool blend;
+};
+
+inline uint64_t Texture::spread(QRgb c)
+{
+    // 0xAARRGGBB -> 0x00AA00GG00RR00BB, one 16 bit lane per channel
+    const uint64_t v = c;
+    return (v & 0x00ff00ff) | ((v << 24) & 0x00ff00ff00000000ull);
+}
+
+inline uint64_t Texture::lerp(uint64_t a, uint64_t b, unsigned int w)
+{
+    // w in [0, 256], every lane stays below 255 * 256
+    return ((a * (256 - w) + b * w) >> 8) & 0x00ff00ff00ff00ffull;
+}
+
+inline QRgb Texture::pack(uint64_t c)
+{
+    return (QRgb)((c & 0x00ff00ff) | ((c >> 24) & 0xff00ff00));
+}
+
+inline QRgb Texture::rampColor(QRgb c, int i)
+{
+    return qRgb((qRed(c) * i + 127) / 255, (qGreen(c) * i + 127) / 255, (qBlue(c) * i + 127) / 255);
+}
+
+inline size_t Texture::interleave(unsigned int v)
+{
+    // abcd -> 0a0b0c0d
+    v = (v | (v << 2)) & 0x33;
+    v = (v | (v << 1)) & 0x55;
+    return v;
+}
+
+inline size_t Texture::rowOffset(const Level& l, int y)
+{
+    if (l.pages) {
+        // tile number in the upper bits, row major inside the tile
+        const int shift = TileStore::tile_shift;
+        return ((size_t)(y >> shift) * l.tiles_x << (2 * shift))
+            | ((size_t)(y & (TileStore::tile_size - 1)) << shift);
+    }
+    if (!l.tiles_x)
+        return (size_t)y * l.stride;
+    const int tile = 1 << tile_shift;
+    return ((size_t)(y >> tile_shift) * l.tiles_x << (2 * tile_shift))
+        | (interleave(y & (tile - 1)) << 1);
+}
+
+inline size_t Texture::columnOffset(const Level& l, int x)
+{
+    if (l.pages) {
+        const int shift = TileStore::tile_shift;
+        return ((size_t)(x >> shift) << (2 * shift)) | (x & (TileStore::tile_size - 1));
+    }
+    if (!l.tiles_x)
+        return x;
+    const int tile = 1 << tile_shift;
+    return ((size_t)(x >> tile_shift) << (2 * tile_shift)) | interleave(x & (tile - 1));
+}
+
+template <TexelFormat F>
+inline QRgb Texture::texel(const Level& l, size_t i) const
+{
+    if (F == TexelFormat::indexed8)
+        return palette[l.bits[i]];
+    if (F == TexelFormat::gray8)
+        return l.bits[i]; // filtered in the lowest lane, see sample()
+    if (l.pages) {
+        const int shift = 2 * TileStore::tile_shift;
+        return l.pages[i >> shift][i & ((1 << shift) - 1)];
+    }
+    return reinterpret_cast<const QRgb*>(l.bits)[i];
+}
+
+inline QRgb Texture::sample(double longitude, double latitude) const
+{
+    switch (format()) {
+    case TexelFormat::indexed8:
+        return sample<TexelFormat::indexed8>(longitude, latitude);
+    case TexelFormat::gray8:
+        return sample<TexelFormat::gray8>(longitude, latitude);
+    default:
+        return sample<TexelFormat::rgb32>(longitude, latitude);
+    }
+}
+
+template <TexelFormat F>
+inline QRgb Texture::sample(double longitude, double latitude, float limb) const
+{
+    // F is the format of base, the mip levels are 32 bit unless gray8
+    const TexelFormat M = (F == TexelFormat::gray8) ? F : TexelFormat::rgb32;
+    uint64_t c = bilinear<F>(*base, longitude, latitude);
+    if (blend && next) {
+        const double t = lod_fraction + limb;
+        if (t > 0.) {
+            const unsigned int w = t >= 1. ? 256 : (unsigned int)(t * 256);
+            c = lerp(c, bilinear<M>(*next, longitude, latitude), w);
+        }
+    }
+    if (F == TexelFormat::gray8)
+        return palette[c & 0xff];
+    return pack(c);
+}
+
+inline void Texture::position(const Level& l, double longitude, double latitude,
+    int64_t& fx, int64_t& fy)
+{
+    fx = (int64_t)((longitude + M_PI) * l.scale_x);
+    fy = (int64_t)((latitude + M_PI / 2) * l.scale_y);
+
+    // over a pole, continue on the opposite meridian
+    if (fy >= l.h_fix) {
+        fy = 2 * l.h_fix - fy;
+        fx += l.w_fix / 2;
+    }
+    else if (fy < 0) {
+        fy = -fy;
+        fx += l.w_fix / 2;
+    }
+    if (fy >= l.h_fix)
+        fy = l.h_fix - 1;
+    if ((uint64_t)fx >= (uint64_t)l.w_fix) {
+        fx %= l.w_fix;
+        if (fx < 0)
+            fx += l.w_fix;
+    }
+}
+
+template <TexelFormat F>
+inline uint64_t Texture::bilinear(const Level& l, double longitude, double latitude) const
+{
+    int64_t fx, fy;
+    position(l, longitude, latitude, fx, fy);
+
+    const int x11 = (int)(fx >> 16);
+    const int y1 = (int)(fy >> 16);
+    int x12 = x11 + 1;
+    if (x12 == l.w)
+        x12 = 0;
+    int x21 = x11;
+    int y2 = y1 + 1;
+    if (y2 == l.h) {
+        y2--;
+        x21 = x11 + l.w / 2;
+        if (x21 >= l.w)
+            x21 -= l.w;
+    }
+
+    const unsigned int dx = (fx >> 8) & 0xff;
+    const unsigned int dy = (fy >> 8) & 0xff;
+
+    // with tiles, the offsets of row and column just add up as well
+    const size_t row1 = rowOffset(l, y1);
+    const size_t row2 = rowOffset(l, y2);
+    const size_t col12 = columnOffset(l, x12);
+    const size_t i11 = row1 + columnOffset(l, x11);
+    const size_t i21 = row2 + columnOffset(l, x21);
+    if (l.pages) {
+        const int shift = 2 * TileStore::tile_shift;
+        if (!l.pages[i11 >> shift] || !l.pages[(row1 + col12) >> shift]
+            || !l.pages[i21 >> shift] || !l.pages[(row2 + col12) >> shift])
+            return bilinear<TexelFormat::rgb32>(*resident, longitude, latitude);
+    }
+    const QRgb c11 = texel<F>(l, i11);
+    const QRgb c12 = texel<F>(l, row1 + col12);
+    const QRgb c21 = texel<F>(l, i21);
+    const QRgb c22 = texel<F>(l, row2 + col12);
+
+    const uint64_t top = lerp(spread(c11), spread(c12), dx);
+    const uint64_t bottom = lerp(spread(c21), spread(c22), dx);
+    return lerp(top, bottom, dy);
+}
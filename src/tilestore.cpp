@@ -0,0 +1,336 @@
+#include "tilestore.h"
+#include "mapcache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char store_magic[8] = { 'X', 'G', 'L', 'O', 'B', 'E', 'T', 'L' };
+const quint32 store_version = 1;
+const int max_levels = 16;
+const size_t tile_bytes = TileStore::tile_size * TileStore::tile_size * sizeof(QRgb);
+
+struct StoreHeader {
+    char magic[8];
+    quint32 version;
+    qint32 levels;
+    qint64 source_size;
+    qint64 source_mtime; // ms since the epoch
+    struct {
+        qint32 w, h;
+        qint32 tiles_x, tiles_y;
+        qint64 offset;
+    } level[max_levels];
+    qint32 resident_w, resident_h;
+    qint64 resident_offset; // rows of 32 bit texels
+};
+
+}
+
+size_t TileStore::cap = 256 << 20;
+
+TileStore::TileStore()
+    : frame(1)
+    , resident_tiles(0)
+{
+}
+
+void TileStore::setMemoryCap(size_t bytes)
+{
+    cap = bytes;
+}
+
+size_t TileStore::memoryCap()
+{
+    return cap;
+}
+
+bool TileStore::wantsPaging(const QString& path)
+{
+    if (!cap)
+        return false;
+    const QSize size = QImageReader(path).size();
+    return size.isValid() && (size_t)size.width() * size.height() * sizeof(QRgb) > cap
+        && size.width() > resident_width;
+}
+
+std::shared_ptr<TileStore> TileStore::open(const QString& path)
+{
+    const QString name = MapCache::cacheFile(path, ".tiles");
+
+    std::shared_ptr<TileStore> store(new TileStore);
+    if (store->load(path, name))
+        return store;
+
+    qDebug() << "Building tile store" << name << "for" << path;
+    if (!build(path, name))
+        return nullptr;
+    store = std::shared_ptr<TileStore>(new TileStore);
+    if (!store->load(path, name))
+        return nullptr;
+    return store;
+}
+
+/*
+ * Header, then the tiles of each level row by row, then the resident
+ * level. Tiles beyond the right and lower edge repeat the last texel.
+ */
+bool TileStore::build(const QString& path, const QString& name)
+{
+    const QFileInfo source(path);
+    QImage image = QImageReader(path).read();
+    if (image.isNull()) {
+        qWarning() << "Can't read" << path;
+        return false;
+    }
+    image = image.convertToFormat(QImage::Format_RGB32);
+
+    StoreHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, store_magic, sizeof(store_magic));
+    h.version = store_version;
+    h.source_size = source.size();
+    h.source_mtime = source.lastModified().toMSecsSinceEpoch();
+
+    // sizes of the levels, each half the one before
+    int w = image.width();
+    int hgt = image.height();
+    qint64 offset = sizeof(h);
+    while (w > resident_width && h.levels < max_levels) {
+        auto& l = h.level[h.levels++];
+        l.w = w;
+        l.h = hgt;
+        l.tiles_x = (w + tile_size - 1) / tile_size;
+        l.tiles_y = (hgt + tile_size - 1) / tile_size;
+        l.offset = offset;
+        offset += (qint64)l.tiles_x * l.tiles_y * tile_bytes;
+        w = (w + 1) / 2;
+        hgt = (hgt + 1) / 2;
+    }
+    h.resident_w = w;
+    h.resident_h = hgt;
+    h.resident_offset = offset;
+
+    QDir().mkpath(QFileInfo(name).absolutePath());
+    QSaveFile file(name);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write tile store" << name << ":" << file.errorString();
+        return false;
+    }
+    bool ok = file.write(reinterpret_cast<const char*>(&h), sizeof(h)) == sizeof(h);
+
+    std::unique_ptr<QRgb[]> tile(new QRgb[tile_size * tile_size]);
+    for (int n = 0; ok && n < h.levels; n++) {
+        const auto& l = h.level[n];
+        for (int ty = 0; ok && ty < l.tiles_y; ty++) {
+            for (int tx = 0; ok && tx < l.tiles_x; tx++) {
+                for (int y = 0; y < tile_size; y++) {
+                    const int sy = std::min(ty * tile_size + y, l.h - 1);
+                    const QRgb* src = reinterpret_cast<const QRgb*>(image.constScanLine(sy));
+                    QRgb* dst = tile.get() + y * tile_size;
+                    for (int x = 0; x < tile_size; x++)
+                        dst[x] = src[std::min(tx * tile_size + x, l.w - 1)];
+                }
+                ok = file.write(reinterpret_cast<const char*>(tile.get()), tile_bytes) == (qint64)tile_bytes;
+            }
+        }
+        const int next_w = n + 1 < h.levels ? h.level[n + 1].w : h.resident_w;
+        const int next_h = n + 1 < h.levels ? h.level[n + 1].h : h.resident_h;
+        image = image.scaled(next_w, next_h, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    for (int y = 0; ok && y < h.resident_h; y++)
+        ok = file.write(reinterpret_cast<const char*>(image.constScanLine(y)), h.resident_w * sizeof(QRgb))
+            == (qint64)(h.resident_w * sizeof(QRgb));
+
+    if (!ok || !file.commit()) {
+        qWarning() << "Can't write tile store" << name << ":" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool TileStore::load(const QString& path, const QString& name)
+{
+    const QFileInfo source(path);
+    file.setFileName(name);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    StoreHeader h;
+    if (file.read(reinterpret_cast<char*>(&h), sizeof(h)) != sizeof(h))
+        return false;
+    if (memcmp(h.magic, store_magic, sizeof(store_magic)) != 0 || h.version != store_version
+        || h.levels < 0 || h.levels > max_levels)
+        return false;
+    if (h.source_size != source.size()
+        || h.source_mtime != source.lastModified().toMSecsSinceEpoch()) {
+        qDebug() << "Tile store out of date:" << name;
+        return false;
+    }
+    if (h.resident_w <= 0 || h.resident_h <= 0
+        || h.resident_offset + (qint64)h.resident_w * h.resident_h * (qint64)sizeof(QRgb) > file.size())
+        return false;
+
+    for (int n = 0; n < h.levels; n++) {
+        Level l;
+        l.w = h.level[n].w;
+        l.h = h.level[n].h;
+        l.tiles_x = h.level[n].tiles_x;
+        l.tiles_y = h.level[n].tiles_y;
+        l.offset = h.level[n].offset;
+        const size_t count = (size_t)l.tiles_x * l.tiles_y;
+        l.table.assign(count, nullptr);
+        l.tiles.resize(count);
+        l.used.assign(count, 0);
+        chain.push_back(std::move(l));
+    }
+
+    fallback = QImage(h.resident_w, h.resident_h, QImage::Format_RGB32);
+    if (!file.seek(h.resident_offset))
+        return false;
+    for (int y = 0; y < h.resident_h; y++) {
+        const qint64 n = h.resident_w * sizeof(QRgb);
+        if (file.read(reinterpret_cast<char*>(fallback.scanLine(y)), n) != n)
+            return false;
+    }
+
+    MapCache::markUsed(file);
+    qDebug() << "Tile store" << name << ":" << chain.size() << "levels, resident"
+             << fallback.width() << "x" << fallback.height();
+    return true;
+}
+
+int TileStore::levels() const
+{
+    return chain.size();
+}
+
+int TileStore::width(int level) const
+{
+    return chain[level].w;
+}
+
+int TileStore::height(int level) const
+{
+    return chain[level].h;
+}
+
+int TileStore::tilesX(int level) const
+{
+    return chain[level].tiles_x;
+}
+
+const QRgb* const* TileStore::pages(int level) const
+{
+    return chain[level].table.data();
+}
+
+const QImage& TileStore::resident() const
+{
+    return fallback;
+}
+
+void TileStore::need(int level, int tx, int ty)
+{
+    Level& l = chain[level];
+    if (tx < 0 || ty < 0 || tx >= l.tiles_x || ty >= l.tiles_y)
+        return;
+    const int i = ty * l.tiles_x + tx;
+    if (l.used[i] == frame)
+        return;
+    l.used[i] = frame;
+    if (!l.table[i])
+        missing.push_back({ level, i });
+}
+
+/*
+ * Read the tiles needed this frame, in file order. Once the cap is
+ * reached, tiles not needed this frame make room, oldest first; if all
+ * resident ones are needed, the rest of the view uses the resident level.
+ */
+void TileStore::pageIn()
+{
+    if (missing.empty()) {
+        frame++;
+        return;
+    }
+    std::sort(missing.begin(), missing.end());
+
+    const size_t max_tiles = std::max<size_t>(cap / tile_bytes, 1);
+    std::vector<std::pair<unsigned int, std::pair<int, int>>> victims;
+    if (resident_tiles + missing.size() > max_tiles) {
+        for (size_t n = 0; n < chain.size(); n++) {
+            for (size_t i = 0; i < chain[n].tiles.size(); i++) {
+                if (chain[n].tiles[i] && chain[n].used[i] != frame)
+                    victims.push_back({ chain[n].used[i], { (int)n, (int)i } });
+            }
+        }
+        // least recently used at the back
+        std::sort(victims.rbegin(), victims.rend());
+    }
+
+    int loaded = 0;
+    int failed = 0;
+    std::unique_ptr<QRgb[]> spare; // of a tile that couldn't be read
+    for (size_t n = 0; n < missing.size(); n++) {
+        const auto& m = missing[n];
+        std::unique_ptr<QRgb[]> tile;
+        if (spare) {
+            tile = std::move(spare);
+        }
+        else if (resident_tiles < max_tiles) {
+            tile.reset(new QRgb[tile_size * tile_size]);
+            resident_tiles++;
+        }
+        else if (!victims.empty()) {
+            Level& v = chain[victims.back().second.first];
+            const int i = victims.back().second.second;
+            victims.pop_back();
+            tile = std::move(v.tiles[i]);
+            v.table[i] = nullptr;
+        }
+        else {
+            qDebug() << "Tile cache full," << missing.size() - n << "tiles left out";
+            break;
+        }
+
+        Level& l = chain[m.first];
+        if (!readTile(m.first, m.second, tile.get())) {
+            // the next one can have the buffer, it isn't in the LRU
+            spare = std::move(tile);
+            failed++;
+            continue;
+        }
+        l.table[m.second] = tile.get();
+        l.tiles[m.second] = std::move(tile);
+        loaded++;
+    }
+    if (spare) {
+        spare.reset();
+        resident_tiles--;
+    }
+    if (failed)
+        qDebug() << "Can't read" << failed << "tiles of" << file.fileName();
+    qDebug() << "Paged in" << loaded << "tiles," << resident_tiles << "in memory";
+
+    missing.clear();
+    frame++;
+}
+
+bool TileStore::readTile(int level, int tile, QRgb* to)
+{
+    const Level& l = chain[level];
+    return file.seek(l.offset + (qint64)tile * tile_bytes)
+        && file.read(reinterpret_cast<char*>(to), tile_bytes) == (qint64)tile_bytes;
+}
+
+size_t TileStore::memoryUsage() const
+{
+    return resident_tiles * tile_bytes + (size_t)fallback.bytesPerLine() * fallback.height();
+}
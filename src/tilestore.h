@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QColor>
+#include <QFile>
+#include <QImage>
+#include <QString>
+#include <memory>
+#include <vector>
+
+/*
+ * On-disk copy of a map too large to keep in memory, split into 256x256
+ * texel tiles for the full map and every mip level down to the first one
+ * no wider than resident_width. That last level is always in memory and
+ * stands in wherever a tile hasn't been paged in.
+ *
+ * Each frame the renderer tells with need() which tiles the view samples,
+ * pageIn() then reads the missing ones and drops the least recently used
+ * to stay below the memory cap. Tiles never change while a frame is being
+ * rendered, so the page tables can be read from any thread.
+ *
+ * The store is built once from the image file, into the cache directory
+ * next to the decoded maps (see MapCache). That first decode still needs
+ * the whole image in memory.
+ */
+class TileStore {
+public:
+    static const int tile_shift = 8;
+    static const int tile_size = 1 << tile_shift;
+    static const int resident_width = 2048;
+
+    /* maps taking more memory than this are paged, 0 for never */
+    static void setMemoryCap(size_t bytes);
+    static size_t memoryCap();
+    static bool wantsPaging(const QString& path);
+
+    /* the tile store of the image file path, built on first use */
+    static std::shared_ptr<TileStore> open(const QString& path);
+
+    int levels() const; // the tiled ones
+    int width(int level) const;
+    int height(int level) const;
+    int tilesX(int level) const;
+    /* one entry per tile, row by row, nullptr if not in memory */
+    const QRgb* const* pages(int level) const;
+    const QImage& resident() const;
+
+    void need(int level, int tx, int ty);
+    void pageIn();
+    size_t memoryUsage() const;
+
+private:
+    TileStore();
+    static bool build(const QString& path, const QString& name);
+    bool load(const QString& path, const QString& name);
+    bool readTile(int level, int tile, QRgb* to);
+
+    struct Level {
+        int w, h;
+        int tiles_x, tiles_y;
+        qint64 offset; // in the store file
+        std::vector<const QRgb*> table;
+        std::vector<std::unique_ptr<QRgb[]>> tiles;
+        std::vector<unsigned int> used; // frame the tile was last needed
+    };
+
+    static size_t cap;
+
+    QFile file;
+    std::vector<Level> chain;
+    QImage fallback;
+    std::vector<std::pair<int, int>> missing; // level, tile
+    unsigned int frame;
+    size_t resident_tiles;
+
+    // don't want to bother with copy
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+};
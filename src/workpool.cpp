@@ -0,0 +1,165 @@
+#include "workpool.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+WorkPool::WorkPool(int threads)
+{
+    if (threads <= 0)
+        threads = defaultThreads();
+
+    for (int i = 0; i < threads; i++)
+        queues.push_back(std::make_unique<Queue>());
+
+    // worker 0 is whoever calls run()
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&WorkPool::worker, this, i);
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers)
+        t.join();
+}
+
+int WorkPool::defaultThreads()
+{
+    const unsigned int n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+int WorkPool::threads() const
+{
+    return queues.size();
+}
+
+namespace {
+
+void lowerPriority(pthread_t thread)
+{
+#ifdef SCHED_IDLE
+    // like QThread::IdlePriority
+    sched_param param = {};
+    pthread_setschedparam(thread, SCHED_IDLE, &param);
+#else
+    (void)thread;
+#endif
+}
+
+}
+
+void WorkPool::setIdlePriority()
+{
+    for (auto& t : workers)
+        lowerPriority(t.native_handle());
+}
+
+void WorkPool::idleThisThread()
+{
+    lowerPriority(pthread_self());
+}
+
+void WorkPool::run(size_t count, const Job& fn)
+{
+    if (count == 0)
+        return;
+
+    // contiguous blocks per worker, neighbouring items share caches
+    const size_t n = queues.size();
+    for (size_t i = 0; i < n; i++) {
+        std::lock_guard<std::mutex> guard(queues[i]->lock);
+        const size_t first = count * i / n;
+        const size_t last = count * (i + 1) / n;
+        for (size_t item = first; item < last; item++)
+            queues[i]->items.push_back(item);
+    }
+
+    if (workers.empty()) {
+        drain(0, &fn);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        job = &fn;
+        generation++;
+        busy++;
+    }
+    wake.notify_all();
+
+    drain(0, &fn);
+
+    std::unique_lock<std::mutex> guard(lock);
+    busy--;
+    // all queues are empty now, wait for items still in flight
+    done.wait(guard, [this] { return busy == 0; });
+    job = nullptr;
+}
+
+void WorkPool::worker(int id)
+{
+    unsigned long seen = 0;
+    for (;;) {
+        const Job* current;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+            current = job;
+            busy++;
+        }
+
+        drain(id, current);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0)
+                done.notify_all();
+        }
+    }
+}
+
+void WorkPool::drain(int id, const Job* fn)
+{
+    // a worker waking up after the run it was signalled for has no job
+    if (!fn)
+        return;
+
+    size_t item;
+    while (next(id, item))
+        (*fn)(item, id);
+}
+
+bool WorkPool::next(int id, size_t& item)
+{
+    const int n = queues.size();
+
+    {
+        Queue& own = *queues[id];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.items.empty()) {
+            item = own.items.back();
+            own.items.pop_back();
+            return true;
+        }
+    }
+
+    for (int i = 1; i < n; i++) {
+        Queue& victim = *queues[(id + i) % n];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.items.empty()) {
+            item = victim.items.front();
+            victim.items.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
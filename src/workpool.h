@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Small work-stealing thread pool. run() hands out the item indices
+ * [0, count) to per-worker queues; a worker pops from the back of its own
+ * queue and, once that is empty, steals from the front of the others.
+ * The calling thread takes part as worker 0, so a pool of one thread runs
+ * everything inline.
+ */
+class WorkPool {
+public:
+    typedef std::function<void(size_t item, int worker)> Job;
+
+    explicit WorkPool(int threads = 0);
+    ~WorkPool();
+
+    int threads() const;
+    void run(size_t count, const Job& job);
+    /* let the workers run only when nothing else wants the CPU */
+    void setIdlePriority();
+
+    static int defaultThreads();
+    static void idleThisThread();
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> items;
+    };
+
+    void worker(int id);
+    void drain(int id, const Job* job);
+    bool next(int id, size_t& item);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const Job* job = nullptr;
+    unsigned long generation = 0;
+    int busy = 0;
+    bool quit = false;
+
+    // don't want to bother with copy
+    WorkPool(const WorkPool&) = delete;
+    WorkPool& operator=(const WorkPool&) = delete;
+};
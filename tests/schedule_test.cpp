@@ -0,0 +1,72 @@
+/*
+ * Runs the -adaptive schedule the way EarthApplication does, frame after
+ * frame, and checks what the frames show.
+ */
+#include "schedule.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, double value)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s (%g)\n", what, value);
+        failures++;
+    }
+}
+
+/*
+ * frames at the wait, warp and radius given, returns the last interval
+ * and the largest step of the shown time after the first frame, which
+ * jumps ahead by wait * warp however long the interval
+ */
+static void run(double warp, int radius, double wait, double* last, double* step)
+{
+    const double pixel = Schedule::pixelTime(radius);
+    double now = 0.;
+    double shown = now; // the first frame, see firstRecalc()
+    *step = 0.;
+    for (int frame = 0; frame < 2000; frame++) {
+        const double interval = Schedule::interval(pixel, now - shown, warp, wait, 300.);
+        const double next = now + interval * warp;
+        if (frame > 0)
+            *step = std::max(*step, fabs(next - shown));
+        shown = next;
+        now += interval;
+        *last = interval;
+    }
+}
+
+int main()
+{
+    const double pixel = Schedule::pixelTime(500); // about 27.5 s
+    check(fabs(pixel - 86400. / (2. * M_PI * 500.)) < 1e-9, "pixel time", pixel);
+    check(std::isinf(Schedule::pixelTime(0)), "pixel time without a globe", Schedule::pixelTime(0));
+
+    double last, step;
+
+    // -timewarp isn't given: 15, see CommandLineParser::getTimeWrap()
+    run(15., 500, 3., &last, &step);
+    check(last > 0.9 * pixel, "default timewarp: interval grows to the pixel time", last);
+    check(step <= pixel + 1e-6, "default timewarp: at most a pixel per frame", step);
+
+    run(1., 500, 3., &last, &step);
+    check(fabs(last - pixel) < 1e-6, "no timewarp: interval is the pixel time", last);
+    check(step <= pixel + 1e-6, "no timewarp: at most a pixel per frame", step);
+
+    run(0.5, 500, 3., &last, &step);
+    check(step <= pixel + 1e-6, "slow timewarp: at most a pixel per frame", step);
+
+    // a large globe changes more often than -wait, which still wins
+    run(15., 20000, 3., &last, &step);
+    check(last == 3., "large globe: interval is -wait", last);
+
+    // a tiny one is still updated now and then
+    run(1., 1, 3., &last, &step);
+    check(last == 300., "tiny globe: interval is the longest", last);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Traces the rows of a grid of views with every vector kernel the cpu
+ * can run and compares them to the scalar reference: the same pixels hit
+ * the globe, and where they do, every output is within one float ulp.
+ */
+#include "compute.h"
+#include "sphere_kernel.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+static int failures = 0;
+
+/*
+ * difference in float ulps of the larger of the two values, or of 1 for
+ * smaller ones: the outputs are angles and unit vectors, close to 0 the
+ * components cancel out and only the absolute error means anything
+ */
+static double ulps(float want, float got)
+{
+    const float scale = std::max(std::max(fabsf(want), fabsf(got)), 1.f);
+    return fabs((double)want - got) / (scale * FLT_EPSILON);
+}
+
+struct Span {
+    explicit Span(int n)
+        : size((n + span_padding - 1) / span_padding * span_padding)
+        , lon(size), lat(size), nx(size), ny(size), nz(size), hit(size)
+    {
+    }
+
+    SurfaceSpan out()
+    {
+        return { lon.data(), lat.data(), nx.data(), ny.data(), nz.data(), hit.data() };
+    }
+
+    int size;
+    std::vector<float> lon, lat, nx, ny, nz;
+    std::vector<unsigned char> hit;
+};
+
+/* the setup renderFrame() makes, see Renderer::calcDistance() */
+static SphereSetup view(int width, int height, double zoom, double rot, double lon, double lat)
+{
+    const double radius = 1000.;
+    const double fov = 0.5 * M_PI / 180.;
+    const double proj_dist = std::min(width, height) / tan(fov);
+    const double tan_a = zoom * std::min(width, height) / 2. / proj_dist;
+    const double center_dist = radius / sin(atan(tan_a));
+
+    SphereSetup s;
+    RotMatrix(rot, lon, lat).elements(s.m);
+    s.dir_z = -proj_dist;
+    s.c = center_dist * center_dist - radius * radius;
+    s.b = 2 * center_dist * s.dir_z;
+    s.center_dist = center_dist;
+    s.inv_radius = 1. / radius;
+    return s;
+}
+
+/*
+ * compares every row of the view, a pixel right at the limb may come out
+ * either way, as a sum of squares rounds a bit differently
+ * @return the largest difference in ulps
+ */
+static double compare(SphereKernel kernel, const char* name, const SphereSetup& s,
+    int width, int height)
+{
+    const SphereKernel reference = sphereKernel(KernelType::scalar);
+    Span want(width), got(width);
+    double worst = 0.;
+
+    for (int py = 0; py < height; py++) {
+        const double dir_y = -py + height / 2;
+        const double dir_x = -width / 2;
+        reference(s, dir_y, dir_x, width, want.out());
+        kernel(s, dir_y, dir_x, width, got.out());
+
+        for (int i = 0; i < width; i++) {
+            if (want.hit[i] != got.hit[i]) {
+                const double x = dir_x + i;
+                const double a = x * x + dir_y * dir_y + s.dir_z * s.dir_z;
+                const double radikand = s.b * s.b - 4 * a * s.c;
+                if (fabs(radikand) > 1e-9 * s.b * s.b) {
+                    fprintf(stderr, "FAILED: %s hit differs at %d,%d\n", name, i, py);
+                    failures++;
+                }
+                continue;
+            }
+            if (!want.hit[i])
+                continue;
+            // the map wraps around, -pi/2 and 3 pi/2 are the same place
+            float lon = got.lon[i];
+            if (lon - want.lon[i] > M_PI)
+                lon -= 2 * M_PI;
+            if (lon - want.lon[i] < -M_PI)
+                lon += 2 * M_PI;
+            worst = std::max(worst, ulps(want.lon[i], lon));
+            worst = std::max(worst, ulps(want.lat[i], got.lat[i]));
+            worst = std::max(worst, ulps(want.nx[i], got.nx[i]));
+            worst = std::max(worst, ulps(want.ny[i], got.ny[i]));
+            worst = std::max(worst, ulps(want.nz[i], got.nz[i]));
+        }
+    }
+    return worst;
+}
+
+int main()
+{
+    const KernelType types[] = { KernelType::sse2, KernelType::avx2, KernelType::avx512 };
+    const double zooms[] = { 0.3, 0.9, 2.5 };
+    const double lats[] = { -90., -60., -0.5, 0., 30., 89.9, 90. };
+    const double rots[] = { 0., 33. };
+    const int width = 131, height = 97; // odd, so rows end in a partial vector
+
+    for (KernelType type : types) {
+        const SphereKernel kernel = sphereKernel(type);
+        const char* name = kernelName(type);
+        if (!kernel) {
+            printf("%s: not supported here, skipped\n", name);
+            continue;
+        }
+        double worst = 0.;
+        for (double zoom : zooms)
+            for (double lat : lats)
+                for (double lon = -180.; lon <= 180.; lon += 60.)
+                    for (double rot : rots) {
+                        const SphereSetup s = view(width, height, zoom,
+                            rot * M_PI / 180., lon * M_PI / 180., lat * M_PI / 180.);
+                        worst = std::max(worst, compare(kernel, name, s, width, height));
+                    }
+        printf("%s: at most %.2f ulp off\n", name, worst);
+        if (worst > 1.) {
+            fprintf(stderr, "FAILED: %s is more than one ulp off the scalar kernel\n", name);
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}